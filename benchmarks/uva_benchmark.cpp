@@ -0,0 +1,1045 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+// Synthesizes a source tree, publishes it and measures the common archive operations on the result.
+// The results are written to stdout as a single JSON object, see print_usage for the options.
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+import pragma.uva;
+
+namespace {
+	struct BenchmarkConfig {
+		std::string workDir = "uva_benchmark";
+		uint32_t numFiles = 10'000;
+		// Subdirectories per directory and number of directory levels, the files are spread evenly over the leaf directories
+		uint32_t fanOut = 8;
+		uint32_t depth = 2;
+		// File sizes are distributed log-uniformly between minSize and maxSize
+		uint64_t minSize = 1024;
+		uint64_t maxSize = 256 * 1024;
+		// Fraction of each file that consists of repeated text, the rest is random
+		double compressibility = 0.5;
+		pragma::uva::Codec codec = pragma::uva::Codec::Bzip2;
+		uint32_t numThreads = 0;
+		// Thread counts that the parallel operations are compared at, by default 1 and one per hardware thread
+		std::vector<uint32_t> threadCounts;
+		uint64_t solidBlockSize = 0;
+		uint32_t chunkSize = 0;
+		// Fraction of the files that are modified for the incremental publish
+		double changedFraction = 0.01;
+		// Fraction of the files that are copies of another file, publish stores their payload only once
+		double duplicateFraction = 0.1;
+		uint32_t iterations = 5;
+		// Entries of the synthesized archive that the startup latency is measured on, 0 to skip the measurement
+		uint32_t indexEntries = 200'000;
+		// List sizes that publish planning is measured at
+		std::vector<uint32_t> planEntries = {10'000, 100'000, 1'000'000};
+		uint64_t seed = 1;
+		bool keepFiles = false;
+	};
+
+	class JsonWriter {
+	  public:
+		void BeginObject(const std::string &key = {})
+		{
+			WriteKey(key);
+			m_out << '{';
+			m_first = true;
+		}
+		void EndObject()
+		{
+			m_out << '}';
+			m_first = false;
+		}
+		void BeginArray(const std::string &key = {})
+		{
+			WriteKey(key);
+			m_out << '[';
+			m_first = true;
+		}
+		void EndArray()
+		{
+			m_out << ']';
+			m_first = false;
+		}
+		void Write(const std::string &key, const std::string &value)
+		{
+			WriteKey(key);
+			m_out << '"';
+			for(auto c : value) {
+				if(c == '"' || c == '\\')
+					m_out << '\\';
+				m_out << c;
+			}
+			m_out << '"';
+		}
+		void Write(const std::string &key, double value)
+		{
+			WriteKey(key);
+			if(std::isfinite(value))
+				m_out << value;
+			else
+				m_out << "null";
+		}
+		void Write(const std::string &key, uint64_t value)
+		{
+			WriteKey(key);
+			m_out << value;
+		}
+		void Write(const std::string &key, bool value)
+		{
+			WriteKey(key);
+			m_out << (value ? "true" : "false");
+		}
+		std::string GetString() const { return m_out.str(); }
+	  private:
+		void WriteKey(const std::string &key)
+		{
+			if(m_first == false)
+				m_out << ',';
+			m_first = false;
+			if(key.empty() == false)
+				m_out << '"' << key << "\":";
+		}
+		std::ostringstream m_out;
+		bool m_first = true;
+	};
+
+	// The library reports its progress through std::cout, which would both distort the timings and the JSON output
+	class ScopedSilence {
+	  public:
+		ScopedSilence() : m_buf {std::cout.rdbuf(m_null.rdbuf())} {}
+		~ScopedSilence() { std::cout.rdbuf(m_buf); }
+	  private:
+		std::ostringstream m_null;
+		std::streambuf *m_buf = nullptr;
+	};
+
+	using Clock = std::chrono::steady_clock;
+	double get_seconds(Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); }
+	double get_median(std::vector<double> values)
+	{
+		if(values.empty())
+			return 0.0;
+		std::sort(values.begin(), values.end());
+		return values.at(values.size() / 2);
+	}
+	double get_rate(double amount, double seconds) { return (seconds > 0.0) ? (amount / seconds) : 0.0; }
+	// Bytes currently allocated on the heap, nullopt where the allocator can't tell
+	std::optional<uint64_t> get_heap_usage()
+	{
+#ifdef __GLIBC__
+		return mallinfo2().uordblks;
+#else
+		return {};
+#endif
+	}
+	constexpr double MB = 1'000'000.0;
+};
+
+static void print_usage()
+{
+	std::cerr << "Usage: uva_benchmark [--option=value ...]\n"
+	          << "  --dir=<path>              Working directory, created if necessary (default: uva_benchmark)\n"
+	          << "  --files=<n>               Number of files (default: 10000)\n"
+	          << "  --fanout=<n>              Subdirectories per directory (default: 8)\n"
+	          << "  --depth=<n>               Directory levels (default: 2)\n"
+	          << "  --min-size=<bytes>        Smallest file size (default: 1024)\n"
+	          << "  --max-size=<bytes>        Largest file size (default: 262144)\n"
+	          << "  --compressibility=<0..1>  Fraction of repeated data per file (default: 0.5)\n"
+	          << "  --codec=<name>            Codec of the published files (default: bzip2)\n"
+	          << "  --threads=<n>             Worker threads, 0 = one per hardware thread (default: 0)\n"
+	          << "  --thread-counts=<n,...>   Thread counts to compare the parallel operations at (default: 1 and one per hardware thread)\n"
+	          << "  --solid-block-size=<n>    PublishOptions::solidBlockSize, also compared with 0 (default: 0, 1048576 for the comparison)\n"
+	          << "  --chunk-size=<n>          PublishOptions::chunkSize, also used for the ReadRange measurements (default: 0, 65536 for those)\n"
+	          << "  --changed=<0..1>          Fraction of files modified for the incremental publish (default: 0.01)\n"
+	          << "  --duplicates=<0..1>       Fraction of files that are copies of another file (default: 0.1)\n"
+	          << "  --iterations=<n>          Repetitions of the open and lookup measurements (default: 5)\n"
+	          << "  --index-entries=<n>       Entries of the archive for the startup measurements, 0 = skip (default: 200000)\n"
+	          << "  --plan-entries=<n,...>    List sizes for the publish planning measurements, 0 = skip (default: 10000,100000,1000000)\n"
+	          << "  --seed=<n>                Seed for the generated data (default: 1)\n"
+	          << "  --keep                    Don't remove the generated files afterwards\n";
+}
+
+static bool parse_args(int argc, char *argv[], BenchmarkConfig &config)
+{
+	for(auto i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(arg.rfind("--", 0) != 0)
+			return false;
+		auto sep = arg.find('=');
+		auto key = arg.substr(2, sep - 2);
+		auto value = (sep != std::string::npos) ? arg.substr(sep + 1) : std::string {};
+		try {
+			if(key == "dir")
+				config.workDir = value;
+			else if(key == "files")
+				config.numFiles = std::stoul(value);
+			else if(key == "fanout")
+				config.fanOut = std::max<uint32_t>(std::stoul(value), 1);
+			else if(key == "depth")
+				config.depth = std::stoul(value);
+			else if(key == "min-size")
+				config.minSize = std::max<uint64_t>(std::stoull(value), 1);
+			else if(key == "max-size")
+				config.maxSize = std::max<uint64_t>(std::stoull(value), 1);
+			else if(key == "compressibility")
+				config.compressibility = std::clamp(std::stod(value), 0.0, 1.0);
+			else if(key == "codec") {
+				auto codec = pragma::uva::string_to_codec(value);
+				if(codec.has_value() == false)
+					return false;
+				config.codec = *codec;
+			}
+			else if(key == "threads")
+				config.numThreads = std::stoul(value);
+			else if(key == "thread-counts") {
+				std::vector<std::string> counts;
+				ustring::explode(value, ",", counts);
+				for(auto &count : counts)
+					config.threadCounts.push_back(std::max<uint32_t>(std::stoul(count), 1));
+			}
+			else if(key == "solid-block-size")
+				config.solidBlockSize = std::stoull(value);
+			else if(key == "chunk-size")
+				config.chunkSize = std::stoul(value);
+			else if(key == "changed")
+				config.changedFraction = std::clamp(std::stod(value), 0.0, 1.0);
+			else if(key == "duplicates")
+				config.duplicateFraction = std::clamp(std::stod(value), 0.0, 1.0);
+			else if(key == "iterations")
+				config.iterations = std::max<uint32_t>(std::stoul(value), 1);
+			else if(key == "index-entries")
+				config.indexEntries = std::stoul(value);
+			else if(key == "plan-entries") {
+				std::vector<std::string> counts;
+				ustring::explode(value, ",", counts);
+				config.planEntries.clear();
+				for(auto &count : counts) {
+					auto n = std::stoul(count);
+					if(n > 0)
+						config.planEntries.push_back(n);
+				}
+			}
+			else if(key == "seed")
+				config.seed = std::stoull(value);
+			else if(key == "keep")
+				config.keepFiles = true;
+			else
+				return false;
+		}
+		catch(const std::exception &) {
+			return false;
+		}
+	}
+	if(config.minSize > config.maxSize)
+		std::swap(config.minSize, config.maxSize);
+	if(config.threadCounts.empty())
+		config.threadCounts = {1, std::max(std::thread::hardware_concurrency(), 1u)};
+	std::sort(config.threadCounts.begin(), config.threadCounts.end());
+	config.threadCounts.erase(std::unique(config.threadCounts.begin(), config.threadCounts.end()), config.threadCounts.end());
+	return true;
+}
+
+// Random bytes followed by repeated text, in blocks of 4 KiB so that the data compresses at about the same ratio throughout
+static void generate_data(std::mt19937_64 &rng, uint64_t size, double compressibility, std::vector<uint8_t> &outData)
+{
+	constexpr uint64_t BLOCK_SIZE = 4096;
+	constexpr std::string_view text = "The quick brown fox jumps over the lazy dog. ";
+	outData.resize(size);
+	auto numRandom = static_cast<uint64_t>(static_cast<double>(BLOCK_SIZE) * (1.0 - compressibility));
+	for(uint64_t offset = 0; offset < size; offset += BLOCK_SIZE) {
+		auto n = std::min(size - offset, BLOCK_SIZE);
+		auto *block = outData.data() + offset;
+		for(uint64_t i = 0; i < n; ++i)
+			block[i] = (i < numRandom) ? static_cast<uint8_t>(rng()) : static_cast<uint8_t>(text[i % text.size()]);
+	}
+}
+
+static std::string get_directory(const BenchmarkConfig &config, uint32_t fileIdx)
+{
+	uint64_t numLeaves = 1;
+	for(uint32_t i = 0; i < config.depth; ++i)
+		numLeaves *= config.fanOut;
+	auto leaf = fileIdx % numLeaves;
+	std::string path;
+	for(uint32_t i = 0; i < config.depth; ++i) {
+		path = "d" + std::to_string(leaf % config.fanOut) + '/' + path;
+		leaf /= config.fanOut;
+	}
+	return path;
+}
+
+// Archive with the given number of empty files and a single version, only its metadata is of interest
+static bool generate_index_archive(const BenchmarkConfig &config, const std::string &archivePath, std::vector<std::string> &outNames)
+{
+	auto archive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(archivePath));
+	if(archive == nullptr)
+		return false;
+	pragma::uva::VersionInfo versionInfo {};
+	versionInfo.version = {0, 0, 1};
+	versionInfo.files.reserve(config.indexEntries);
+	outNames.reserve(config.indexEntries);
+	for(uint32_t i = 0; i < config.indexEntries; ++i) {
+		auto name = get_directory(config, i) + "e" + std::to_string(i) + ".bin";
+		uint32_t idx;
+		if(archive->AddFile(name, idx) == nullptr)
+			return false;
+		versionInfo.files.push_back(idx);
+		outNames.push_back(std::move(name));
+	}
+	archive->AddVersion(versionInfo);
+	ScopedSilence silence {};
+	return archive->Export(pragma::uva::ExportMode::Rewrite);
+}
+
+// Archive with the given number of entries and the list that publishes them again. The entries have a recorded source
+// stat that matches the one in the list, so the publish skips all of them without opening any files. The payload is
+// shared by all entries and never extracted.
+static bool generate_planning_archive(const BenchmarkConfig &config, uint32_t numEntries, const std::string &archivePath, std::vector<pragma::uva::PublishInfo> &outFiles)
+{
+	auto archive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(archivePath));
+	if(archive == nullptr)
+		return false;
+	auto payload = std::make_shared<std::vector<uint8_t>>(1, 0);
+	pragma::uva::VersionInfo versionInfo {};
+	versionInfo.version = {0, 0, 1};
+	versionInfo.files.reserve(numEntries);
+	outFiles.reserve(numEntries + numEntries / 100);
+	for(uint32_t i = 0; i < numEntries; ++i) {
+		auto dir = get_directory(config, i);
+		auto name = "e" + std::to_string(i) + ".bin";
+		uint32_t idx;
+		auto *fi = archive->AddFile(dir + name, idx);
+		if(fi == nullptr)
+			return false;
+		pragma::uva::FileStat stat {payload->size(), 1, i + 1ull};
+		fi->SetCodec(pragma::uva::Codec::Store);
+		fi->size = payload->size();
+		fi->sizeUncompressed = payload->size();
+		fi->contentHash = 1;
+		fi->sourceStat = stat;
+		fi->data = payload;
+		versionInfo.files.push_back(idx);
+
+		pragma::uva::PublishInfo info {};
+		info.file = "plan/" + dir + name;
+		info.src = dir;
+		info.stat = stat;
+		outFiles.push_back(info);
+		// Every hundredth file is listed twice, duplicates are removed by the planning as well
+		if(i % 100 == 0)
+			outFiles.push_back(std::move(info));
+	}
+	archive->AddVersion(versionInfo);
+	ScopedSilence silence {};
+	return archive->Export(pragma::uva::ExportMode::Rewrite);
+}
+
+// Baseline for FindFile: Resolves the path one segment at a time by scanning the children of each directory, the way
+// lookups worked before the archive had a path index
+static uint32_t find_by_tree_walk(const pragma::uva::ArchiveFile &archive, const std::string &path)
+{
+	auto npath = FileManager::GetCanonicalizedPath(path);
+	std::vector<std::string> subPaths;
+	ustring::explode(npath, std::string(1, FileManager::GetDirectorySeparator()).c_str(), subPaths);
+	auto &files = archive.GetFiles();
+	auto fii = archive.GetRoot();
+	for(auto &subPath : subPaths) {
+		auto found = false;
+		for(auto child : fii.GetChildren()) {
+			if(ustring::compare(subPath, std::string {files.at(child.index).name}, false)) {
+				fii = child;
+				found = true;
+				break;
+			}
+		}
+		if(found == false)
+			return std::numeric_limits<uint32_t>::max();
+	}
+	return fii.index;
+}
+
+// Baseline for walk_directory: Lists one directory at a time through FileManager::FindSystemFiles and recurses into the
+// subdirectories, the way the directories of an update list were expanded before. Doesn't capture any file metadata.
+static void find_all_files(std::string path, std::vector<std::string> &outFiles)
+{
+	path = FileManager::GetCanonicalizedPath(path);
+	std::vector<std::string> files;
+	std::vector<std::string> dirs;
+	FileManager::FindSystemFiles((path + "/*").c_str(), &files, &dirs);
+	for(auto &file : files)
+		outFiles.push_back(path + '/' + file);
+	for(auto &dir : dirs)
+		find_all_files(path + '/' + dir, outFiles);
+}
+
+// Returns the archive names of the files, which are relative to the source directory
+static std::vector<std::string> generate_source_tree(const BenchmarkConfig &config, const std::filesystem::path &srcDir, uint64_t &outNumBytes, uint64_t &outNumDuplicates)
+{
+	std::mt19937_64 rng {config.seed};
+	std::uniform_real_distribution<double> sizeDist {std::log(static_cast<double>(config.minSize)), std::log(static_cast<double>(config.maxSize))};
+	std::uniform_real_distribution<double> duplicateDist {0.0, 1.0};
+	std::vector<std::string> names;
+	names.reserve(config.numFiles);
+	std::vector<uint8_t> data;
+	outNumBytes = 0;
+	outNumDuplicates = 0;
+	for(uint32_t i = 0; i < config.numFiles; ++i) {
+		auto name = get_directory(config, i) + "f" + std::to_string(i) + ".bin";
+		auto path = srcDir / name;
+		std::filesystem::create_directories(path.parent_path());
+		if(i > 0 && duplicateDist(rng) < config.duplicateFraction) {
+			auto &original = names.at(rng() % names.size());
+			std::filesystem::copy_file(srcDir / original, path, std::filesystem::copy_options::overwrite_existing);
+			outNumBytes += std::filesystem::file_size(path);
+			++outNumDuplicates;
+			names.push_back(std::move(name));
+			continue;
+		}
+		auto size = std::clamp<uint64_t>(static_cast<uint64_t>(std::exp(sizeDist(rng))), config.minSize, config.maxSize);
+		generate_data(rng, size, config.compressibility, data);
+		std::ofstream {path, std::ios::binary}.write(reinterpret_cast<const char *>(data.data()), data.size());
+		outNumBytes += size;
+		names.push_back(std::move(name));
+	}
+	return names;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchmarkConfig config {};
+	if(parse_args(argc, argv, config) == false) {
+		print_usage();
+		return EXIT_FAILURE;
+	}
+	auto workDir = std::filesystem::absolute(config.workDir);
+	auto srcDir = workDir / "src";
+	auto archivePath = (workDir / "benchmark.dat").string();
+	std::filesystem::remove_all(workDir);
+	std::filesystem::create_directories(srcDir);
+
+	JsonWriter json {};
+	json.BeginObject();
+	json.BeginObject("config");
+	json.Write("files", static_cast<uint64_t>(config.numFiles));
+	json.Write("fanout", static_cast<uint64_t>(config.fanOut));
+	json.Write("depth", static_cast<uint64_t>(config.depth));
+	json.Write("min_size", config.minSize);
+	json.Write("max_size", config.maxSize);
+	json.Write("compressibility", config.compressibility);
+	json.Write("codec", pragma::uva::codec_to_string(config.codec));
+	json.Write("threads", static_cast<uint64_t>(config.numThreads));
+	json.BeginArray("thread_counts");
+	for(auto count : config.threadCounts)
+		json.Write({}, static_cast<uint64_t>(count));
+	json.EndArray();
+	json.Write("solid_block_size", config.solidBlockSize);
+	json.Write("chunk_size", static_cast<uint64_t>(config.chunkSize));
+	json.Write("duplicates", config.duplicateFraction);
+	json.Write("iterations", static_cast<uint64_t>(config.iterations));
+	json.Write("index_entries", static_cast<uint64_t>(config.indexEntries));
+	json.BeginArray("plan_entries");
+	for(auto count : config.planEntries)
+		json.Write({}, static_cast<uint64_t>(count));
+	json.EndArray();
+	json.Write("seed", config.seed);
+	json.EndObject();
+
+	auto success = true;
+	uint64_t numSourceBytes = 0;
+	uint64_t numDuplicates = 0;
+	auto tGenerate = Clock::now();
+	auto names = generate_source_tree(config, srcDir, numSourceBytes, numDuplicates);
+	json.BeginObject("generate");
+	json.Write("bytes", numSourceBytes);
+	json.Write("duplicate_files", numDuplicates);
+	json.Write("seconds", get_seconds(tGenerate));
+	json.EndObject();
+	{
+		// Enumerating the generated tree, compared with the recursive enumeration the directories were expanded with before
+		auto root = FileManager::GetCanonicalizedPath(srcDir.string());
+		std::vector<std::string> files;
+		auto t = Clock::now();
+		find_all_files(root, files);
+		auto seconds = get_seconds(t);
+		if(files.size() != names.size())
+			success = false;
+		json.BeginObject("discovery");
+		json.Write("files", static_cast<uint64_t>(names.size()));
+		json.Write("find_all_files_seconds", seconds);
+		json.Write("find_all_files_per_second", get_rate(static_cast<double>(files.size()), seconds));
+		json.BeginArray("walk_directory");
+		for(auto numThreads : config.threadCounts) {
+			t = Clock::now();
+			auto entries = pragma::uva::walk_directory(root, numThreads);
+			seconds = get_seconds(t);
+			if(entries.size() != names.size())
+				success = false;
+			json.BeginObject();
+			json.Write("threads", static_cast<uint64_t>(numThreads));
+			json.Write("seconds", seconds);
+			json.Write("files_per_second", get_rate(static_cast<double>(entries.size()), seconds));
+			json.EndObject();
+		}
+		json.EndArray();
+		json.EndObject();
+	}
+	auto listFile = (workDir / "list.txt").string();
+	std::ofstream {listFile} << "src/**\n";
+
+	pragma::uva::PublishOptions publishOptions {};
+	publishOptions.numThreads = config.numThreads;
+	publishOptions.codec = config.codec;
+	publishOptions.solidBlockSize = config.solidBlockSize;
+	publishOptions.chunkSize = config.chunkSize;
+	auto fPublish = [&](const std::string &key, const std::string &path, const pragma::uva::PublishOptions &options, uint64_t numBytes, uint64_t numFiles) {
+		util::Version version {};
+		pragma::uva::ArchiveFile::UpdateResult result;
+		auto t = Clock::now();
+		{
+			ScopedSilence silence {};
+			result = pragma::uva::ArchiveFile::PublishUpdate(version, listFile, path, nullptr, nullptr, nullptr, options);
+		}
+		auto seconds = get_seconds(t);
+		if(result != pragma::uva::ArchiveFile::UpdateResult::Success && result != pragma::uva::ArchiveFile::UpdateResult::NothingToUpdate)
+			success = false;
+		json.BeginObject(key);
+		json.Write("threads", static_cast<uint64_t>(options.numThreads));
+		json.Write("result", pragma::uva::ArchiveFile::result_code_to_string(result));
+		json.Write("seconds", seconds);
+		json.Write("files_per_second", get_rate(static_cast<double>(numFiles), seconds));
+		json.Write("mb_per_second", get_rate(static_cast<double>(numBytes) / MB, seconds));
+		json.EndObject();
+	};
+	publishOptions.exportMode = pragma::uva::ExportMode::Rewrite;
+	fPublish("publish", archivePath, publishOptions, numSourceBytes, names.size());
+	// The same publish into archives of their own, at each of the thread counts
+	json.BeginArray("publish_by_threads");
+	for(auto numThreads : config.threadCounts) {
+		auto options = publishOptions;
+		options.numThreads = numThreads;
+		auto path = (workDir / ("publish_" + std::to_string(numThreads) + ".dat")).string();
+		fPublish({}, path, options, numSourceBytes, names.size());
+		std::filesystem::remove(path);
+	}
+	json.EndArray();
+	publishOptions.exportMode = pragma::uva::ExportMode::Append;
+	fPublish("publish_unchanged", archivePath, publishOptions, numSourceBytes, names.size());
+	{
+		// Detects the unchanged files by their content hash instead
+		auto options = publishOptions;
+		options.skipUnchangedByStat = false;
+		fPublish("publish_unchanged_hashed", archivePath, options, numSourceBytes, names.size());
+	}
+	{
+		// Modified files get a new mtime as well, so they aren't skipped by their stat
+		std::mt19937_64 rng {config.seed + 1};
+		auto numChanged = static_cast<uint64_t>(static_cast<double>(names.size()) * config.changedFraction);
+		uint64_t numChangedBytes = 0;
+		std::vector<uint8_t> data;
+		for(uint64_t i = 0; i < numChanged; ++i) {
+			auto path = srcDir / names.at(rng() % names.size());
+			generate_data(rng, std::filesystem::file_size(path), config.compressibility, data);
+			std::ofstream {path, std::ios::binary}.write(reinterpret_cast<const char *>(data.data()), data.size());
+			numChangedBytes += data.size();
+		}
+		fPublish("publish_incremental", archivePath, publishOptions, numChangedBytes, numChanged);
+	}
+	auto archiveSize = std::filesystem::exists(archivePath) ? std::filesystem::file_size(archivePath) : 0;
+	json.Write("archive_size", static_cast<uint64_t>(archiveSize));
+
+	// Open latency, until the first lookup succeeds. The index is loaded on demand.
+	{
+		std::vector<double> openTimes;
+		std::vector<double> firstLookupTimes;
+		for(uint32_t i = 0; i < config.iterations; ++i) {
+			auto t = Clock::now();
+			auto archive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(archivePath));
+			openTimes.push_back(get_seconds(t) * 1'000.0);
+			if(archive == nullptr || archive->FindFile(names.front()) == nullptr)
+				success = false;
+			firstLookupTimes.push_back(get_seconds(t) * 1'000.0);
+		}
+		json.BeginObject("open");
+		json.Write("median_ms", get_median(openTimes));
+		json.Write("min_ms", *std::min_element(openTimes.begin(), openTimes.end()));
+		json.Write("first_lookup_median_ms", get_median(firstLookupTimes));
+		json.EndObject();
+	}
+
+	auto archive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(archivePath));
+	if(archive == nullptr) {
+		std::cerr << "Unable to open archive '" << archivePath << "'!" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::mt19937_64 rng {config.seed};
+	auto lookupOrder = names;
+	std::shuffle(lookupOrder.begin(), lookupOrder.end(), rng);
+	{
+		uint64_t numFound = 0;
+		archive->FindFile(lookupOrder.front());
+		auto t = Clock::now();
+		for(uint32_t i = 0; i < config.iterations; ++i) {
+			for(auto &name : lookupOrder)
+				numFound += (archive->FindFile(name) != nullptr) ? 1 : 0;
+		}
+		auto seconds = get_seconds(t);
+		auto numLookups = static_cast<uint64_t>(lookupOrder.size()) * config.iterations;
+		if(numFound != numLookups)
+			success = false;
+		std::vector<std::string> missingNames;
+		missingNames.reserve(lookupOrder.size());
+		for(auto &name : lookupOrder)
+			missingNames.push_back(name + ".missing");
+		t = Clock::now();
+		for(uint32_t i = 0; i < config.iterations; ++i) {
+			for(auto &name : missingNames)
+				numFound += (archive->FindFile(name) != nullptr) ? 1 : 0;
+		}
+		auto secondsMissing = get_seconds(t);
+		uint64_t numFoundTreeWalk = 0;
+		t = Clock::now();
+		for(uint32_t i = 0; i < config.iterations; ++i) {
+			for(auto &name : lookupOrder) {
+				uint32_t idx;
+				if(archive->FindFile(name, idx) != nullptr && find_by_tree_walk(*archive, name) == idx)
+					++numFoundTreeWalk;
+			}
+		}
+		// The index lookups are part of the measurement for validation, subtract them again
+		auto secondsTreeWalk = std::max(get_seconds(t) - seconds, 0.0);
+		if(numFoundTreeWalk != numLookups)
+			success = false;
+		json.BeginObject("find_file");
+		json.Write("lookups", numLookups);
+		json.Write("hits_per_second", get_rate(static_cast<double>(numLookups), seconds));
+		json.Write("misses_per_second", get_rate(static_cast<double>(numLookups), secondsMissing));
+		json.Write("tree_walk_hits_per_second", get_rate(static_cast<double>(numLookups), secondsTreeWalk));
+		json.EndObject();
+	}
+	{
+		// One pattern per leaf directory, all files of the directory match
+		std::set<std::string> patterns;
+		for(uint32_t i = 0; i < std::min<uint32_t>(config.numFiles, 1'000); ++i)
+			patterns.insert(get_directory(config, i) + "*.bin");
+		std::vector<pragma::uva::FileInfo *> results;
+		uint64_t numResults = 0;
+		auto t = Clock::now();
+		for(uint32_t i = 0; i < config.iterations; ++i) {
+			for(auto &pattern : patterns) {
+				results.clear();
+				archive->SearchFiles(pattern, results);
+				numResults += results.size();
+			}
+		}
+		auto seconds = get_seconds(t);
+		auto numSearches = static_cast<uint64_t>(patterns.size()) * config.iterations;
+		json.BeginObject("search_files");
+		json.Write("searches", numSearches);
+		json.Write("results_per_search", get_rate(static_cast<double>(numResults), static_cast<double>(numSearches)));
+		json.Write("searches_per_second", get_rate(static_cast<double>(numSearches), seconds));
+		json.EndObject();
+	}
+	{
+		std::vector<uint8_t> data;
+		uint64_t numBytes = 0;
+		auto t = Clock::now();
+		for(auto &name : lookupOrder) {
+			if(archive->ExtractData(name, data) == false) {
+				success = false;
+				continue;
+			}
+			numBytes += data.size();
+		}
+		auto seconds = get_seconds(t);
+		json.BeginObject("extract_data");
+		json.Write("bytes", numBytes);
+		json.Write("seconds", seconds);
+		json.Write("mb_per_second", get_rate(static_cast<double>(numBytes) / MB, seconds));
+		json.EndObject();
+	}
+	{
+		// Open and read through a mount, compared with reading the loose source files
+		auto mountedArchive = std::shared_ptr<const pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(archivePath));
+		pragma::uva::Mount mount {};
+		mount.AddArchive(mountedArchive);
+		auto numSamples = std::min<size_t>(lookupOrder.size(), 1'000);
+		std::vector<uint8_t> data;
+		std::vector<double> mountTimes;
+		std::vector<double> looseTimes;
+		uint64_t numBytes = 0;
+		for(size_t i = 0; i < numSamples; ++i) {
+			auto &name = lookupOrder.at(i);
+			auto t = Clock::now();
+			auto stream = mount.OpenFile(name);
+			if(stream == nullptr) {
+				success = false;
+				continue;
+			}
+			data.resize(stream->GetSize());
+			if(stream->Read(data.data(), data.size()) != data.size())
+				success = false;
+			mountTimes.push_back(get_seconds(t) * 1'000'000.0);
+			numBytes += data.size();
+
+			t = Clock::now();
+			std::ifstream f {srcDir / name, std::ios::binary};
+			f.seekg(0, std::ios::end);
+			data.resize(f.tellg());
+			f.seekg(0, std::ios::beg);
+			f.read(reinterpret_cast<char *>(data.data()), data.size());
+			looseTimes.push_back(get_seconds(t) * 1'000'000.0);
+		}
+		auto fSum = [](const std::vector<double> &values) { return std::accumulate(values.begin(), values.end(), 0.0); };
+		json.BeginObject("mount_open_read");
+		json.Write("files", static_cast<uint64_t>(mountTimes.size()));
+		json.Write("median_us", get_median(mountTimes));
+		json.Write("mb_per_second", get_rate(static_cast<double>(numBytes) / MB, fSum(mountTimes) / 1'000'000.0));
+		json.Write("loose_median_us", get_median(looseTimes));
+		json.Write("loose_mb_per_second", get_rate(static_cast<double>(numBytes) / MB, fSum(looseTimes) / 1'000'000.0));
+		json.EndObject();
+	}
+	json.BeginArray("extract_all");
+	for(auto numThreads : config.threadCounts) {
+		auto extractDir = workDir / "extract";
+		std::filesystem::remove_all(extractDir);
+		auto stats = archive->ExtractAll(extractDir.string(), numThreads);
+		if(stats.numFailed > 0)
+			success = false;
+		json.BeginObject();
+		json.Write("threads", static_cast<uint64_t>(numThreads));
+		json.Write("files", static_cast<uint64_t>(stats.numFiles));
+		json.Write("failed", static_cast<uint64_t>(stats.numFailed));
+		json.Write("bytes", stats.numBytes);
+		json.Write("seconds", std::chrono::duration<double>(stats.duration).count());
+		json.Write("mb_per_second", stats.GetThroughput() / MB);
+		json.EndObject();
+		std::filesystem::remove_all(extractDir);
+	}
+	json.EndArray();
+	{
+		// The same tree published with and without solid blocks, the extraction latency is measured per file
+		auto solidBlockSize = (config.solidBlockSize > 0) ? config.solidBlockSize : 1024 * 1024;
+		auto numSamples = std::min<size_t>(lookupOrder.size(), 1'000);
+		auto fMeasureSolid = [&](const std::string &key, uint64_t blockSize) {
+			auto path = (workDir / ("solid_" + std::to_string(blockSize) + ".dat")).string();
+			auto options = publishOptions;
+			options.exportMode = pragma::uva::ExportMode::Rewrite;
+			options.solidBlockSize = blockSize;
+			pragma::uva::ArchiveFile::UpdateResult result;
+			{
+				ScopedSilence silence {};
+				util::Version version {};
+				result = pragma::uva::ArchiveFile::PublishUpdate(version, listFile, path, nullptr, nullptr, nullptr, options);
+			}
+			auto solidArchive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(path));
+			if(result != pragma::uva::ArchiveFile::UpdateResult::Success || solidArchive == nullptr)
+				success = false;
+			std::vector<uint8_t> data;
+			std::vector<double> extractTimes;
+			for(size_t i = 0; i < numSamples && solidArchive != nullptr; ++i) {
+				auto t = Clock::now();
+				if(solidArchive->ExtractData(lookupOrder.at(i), data) == false)
+					success = false;
+				extractTimes.push_back(get_seconds(t) * 1'000'000.0);
+			}
+			json.BeginObject(key);
+			json.Write("solid_block_size", blockSize);
+			json.Write("archive_size", static_cast<uint64_t>(std::filesystem::exists(path) ? std::filesystem::file_size(path) : 0));
+			json.Write("files", static_cast<uint64_t>(extractTimes.size()));
+			json.Write("extract_median_us", get_median(extractTimes));
+			json.EndObject();
+			solidArchive = nullptr;
+			std::filesystem::remove(path);
+		};
+		json.BeginObject("solid");
+		json.Write("solid_file_size_limit", publishOptions.solidFileSizeLimit);
+		fMeasureSolid("without", 0);
+		fMeasureSolid("with", solidBlockSize);
+		json.EndObject();
+	}
+	{
+		// Random slices of chunked files, compared with extracting the whole file
+		constexpr uint64_t SLICE_SIZE = 4096;
+		auto chunkSize = (config.chunkSize > 0) ? config.chunkSize : 64 * 1024;
+		auto path = (workDir / "chunked.dat").string();
+		auto options = publishOptions;
+		options.exportMode = pragma::uva::ExportMode::Rewrite;
+		options.chunkSize = chunkSize;
+		pragma::uva::ArchiveFile::UpdateResult result;
+		{
+			ScopedSilence silence {};
+			util::Version version {};
+			result = pragma::uva::ArchiveFile::PublishUpdate(version, listFile, path, nullptr, nullptr, nullptr, options);
+		}
+		auto chunkedArchive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(path));
+		if(result != pragma::uva::ArchiveFile::UpdateResult::Success || chunkedArchive == nullptr)
+			success = false;
+		std::mt19937_64 sliceRng {config.seed + 3};
+		std::vector<uint8_t> slice(SLICE_SIZE);
+		std::vector<uint8_t> data;
+		std::vector<double> rangeTimes;
+		std::vector<double> extractTimes;
+		// Only chunked files can skip the parts of the payload that are outside of the slice
+		std::vector<double> chunkedRangeTimes;
+		std::vector<double> chunkedExtractTimes;
+		for(size_t i = 0; i < lookupOrder.size() && rangeTimes.size() < 1'000 && chunkedArchive != nullptr; ++i) {
+			auto &name = lookupOrder.at(i);
+			auto *fi = chunkedArchive->FindFile(name);
+			if(fi == nullptr) {
+				success = false;
+				continue;
+			}
+			if(fi->sizeUncompressed < SLICE_SIZE)
+				continue;
+			auto offset = sliceRng() % (fi->sizeUncompressed - SLICE_SIZE + 1);
+			// Reads the file once beforehand, so neither of the measurements pays for faulting in the payload
+			chunkedArchive->ExtractData(name, data);
+			auto t = Clock::now();
+			if(chunkedArchive->ReadRange(name, offset, slice) == false)
+				success = false;
+			auto rangeTime = get_seconds(t) * 1'000'000.0;
+
+			t = Clock::now();
+			auto extracted = chunkedArchive->ExtractData(name, data);
+			auto extractTime = get_seconds(t) * 1'000'000.0;
+			if(extracted == false || data.size() < offset + SLICE_SIZE || std::equal(slice.begin(), slice.end(), data.begin() + offset) == false)
+				success = false;
+			rangeTimes.push_back(rangeTime);
+			extractTimes.push_back(extractTime);
+			if(fi->IsChunked()) {
+				chunkedRangeTimes.push_back(rangeTime);
+				chunkedExtractTimes.push_back(extractTime);
+			}
+		}
+		json.BeginObject("read_range");
+		json.Write("chunk_size", static_cast<uint64_t>(chunkSize));
+		json.Write("slice_bytes", SLICE_SIZE);
+		json.Write("files", static_cast<uint64_t>(rangeTimes.size()));
+		json.Write("median_us", get_median(rangeTimes));
+		json.Write("extract_data_median_us", get_median(extractTimes));
+		json.Write("chunked_files", static_cast<uint64_t>(chunkedRangeTimes.size()));
+		json.Write("chunked_median_us", get_median(chunkedRangeTimes));
+		json.Write("chunked_extract_data_median_us", get_median(chunkedExtractTimes));
+		json.EndObject();
+		chunkedArchive = nullptr;
+		std::filesystem::remove(path);
+	}
+	// Rewrites the whole archive, i.e. copies all payloads and writes the metadata
+	auto fExport = [&](const std::string &key, pragma::uva::ArchiveFile &archive) {
+		bool exported;
+		auto t = Clock::now();
+		{
+			ScopedSilence silence {};
+			exported = archive.Export(pragma::uva::ExportMode::Rewrite);
+		}
+		auto seconds = get_seconds(t);
+		if(exported == false)
+			success = false;
+		json.BeginObject(key);
+		json.Write("success", exported);
+		json.Write("seconds", seconds);
+		json.Write("mb_per_second", get_rate(static_cast<double>(archiveSize) / MB, seconds));
+		json.EndObject();
+	};
+	fExport("export", *archive);
+	archive = nullptr;
+	{
+		// Substituting the stream in the read callback disables the native handle, so the payloads are copied through
+		// the stream instead of with copy_file_range
+		auto bufferedArchive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(archivePath, [&archivePath](VFilePtr &f) {
+			f = FileManager::OpenSystemFile(archivePath.c_str(), "rb");
+			return f != nullptr;
+		}));
+		if(bufferedArchive != nullptr)
+			fExport("export_buffered", *bufferedArchive);
+		else
+			success = false;
+	}
+	{
+		// Patch from the current archive to a republish in which some of the files have been edited, added and deleted
+		auto basePath = (workDir / "patch_base.dat").string();
+		auto patchPath = (workDir / "patch.dat").string();
+		std::filesystem::copy_file(archivePath, basePath, std::filesystem::copy_options::overwrite_existing);
+		std::mt19937_64 rng {config.seed + 2};
+		auto numModified = std::max<uint64_t>(static_cast<uint64_t>(static_cast<double>(names.size()) * config.changedFraction), 1);
+		uint64_t numEdited = 0;
+		uint64_t numDeleted = 0;
+		std::vector<uint8_t> data;
+		for(uint64_t i = 0; i < numModified; ++i) {
+			auto path = srcDir / names.at(rng() % names.size());
+			// Small edits, so the deltas have something to refer to
+			std::ifstream in {path, std::ios::binary};
+			data.assign(std::istreambuf_iterator<char> {in}, std::istreambuf_iterator<char> {});
+			in.close();
+			for(auto j = 0; j < 4 && data.empty() == false; ++j)
+				data.at(rng() % data.size()) = static_cast<uint8_t>(rng());
+			std::ofstream {path, std::ios::binary}.write(reinterpret_cast<const char *>(data.data()), data.size());
+			++numEdited;
+		}
+		for(uint64_t i = 0; i < numModified; ++i) {
+			auto path = srcDir / (get_directory(config, static_cast<uint32_t>(i)) + "patch" + std::to_string(i) + ".bin");
+			generate_data(rng, config.minSize, config.compressibility, data);
+			std::ofstream {path, std::ios::binary}.write(reinterpret_cast<const char *>(data.data()), data.size());
+		}
+		for(uint64_t i = 0; i < numModified; ++i)
+			numDeleted += std::filesystem::remove(srcDir / names.at(rng() % names.size())) ? 1 : 0;
+		pragma::uva::ArchiveFile::UpdateResult result;
+		{
+			ScopedSilence silence {};
+			util::Version version {};
+			auto options = publishOptions;
+			options.exportMode = pragma::uva::ExportMode::Rewrite;
+			result = pragma::uva::ArchiveFile::PublishUpdate(version, listFile, archivePath, nullptr, nullptr, nullptr, options);
+		}
+		auto created = false;
+		auto applied = false;
+		double createSeconds = 0.0;
+		double applySeconds = 0.0;
+		if(result == pragma::uva::ArchiveFile::UpdateResult::Success) {
+			auto target = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(archivePath));
+			auto base = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(basePath));
+			pragma::uva::PatchOptions patchOptions {};
+			patchOptions.codec = config.codec;
+			auto t = Clock::now();
+			{
+				ScopedSilence silence {};
+				created = (target != nullptr && base != nullptr && target->CreatePatch(*base, patchPath, patchOptions));
+			}
+			createSeconds = get_seconds(t);
+			base = nullptr;
+
+			base = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(basePath));
+			t = Clock::now();
+			{
+				ScopedSilence silence {};
+				applied = (created && base != nullptr && base->ApplyPatch(patchPath));
+			}
+			applySeconds = get_seconds(t);
+			util::Version targetVersion {};
+			util::Version patchedVersion {};
+			if(applied && (target->GetLatestVersion(&targetVersion) == false || base->GetLatestVersion(&patchedVersion) == false || patchedVersion != targetVersion))
+				applied = false;
+		}
+		if(created == false || applied == false)
+			success = false;
+		json.BeginObject("patch");
+		json.Write("files_edited", numEdited);
+		json.Write("files_added", numModified);
+		json.Write("files_deleted", numDeleted);
+		json.Write("archive_size", static_cast<uint64_t>(std::filesystem::exists(archivePath) ? std::filesystem::file_size(archivePath) : 0));
+		json.Write("patch_bytes", static_cast<uint64_t>(created ? std::filesystem::file_size(patchPath) : 0));
+		json.Write("create_seconds", createSeconds);
+		json.Write("apply_seconds", applySeconds);
+		json.EndObject();
+		std::filesystem::remove(basePath);
+		std::filesystem::remove(patchPath);
+	}
+
+	// Startup latency on a large index. A version check only loads the version layer, a lookup the file index.
+	if(config.indexEntries > 0) {
+		auto indexArchivePath = (workDir / "index.dat").string();
+		std::vector<std::string> indexNames;
+		if(generate_index_archive(config, indexArchivePath, indexNames)) {
+			std::vector<double> openTimes;
+			std::vector<double> versionTimes;
+			std::vector<double> lookupTimes;
+			std::vector<double> loadTimes;
+			for(uint32_t i = 0; i < config.iterations; ++i) {
+				auto t = Clock::now();
+				auto indexArchive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(indexArchivePath));
+				openTimes.push_back(get_seconds(t) * 1'000.0);
+				util::Version version {};
+				if(indexArchive == nullptr || indexArchive->GetLatestVersion(&version) == false)
+					success = false;
+				versionTimes.push_back(get_seconds(t) * 1'000.0);
+				indexArchive = nullptr;
+
+				t = Clock::now();
+				indexArchive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(indexArchivePath));
+				if(indexArchive == nullptr || indexArchive->FindFile(indexNames.at(i % indexNames.size())) == nullptr)
+					success = false;
+				lookupTimes.push_back(get_seconds(t) * 1'000.0);
+				indexArchive = nullptr;
+
+				// All metadata sections
+				t = Clock::now();
+				indexArchive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(indexArchivePath));
+				if(indexArchive == nullptr || indexArchive->GetVersions().empty() || indexArchive->FindFile(indexNames.at(i % indexNames.size())) == nullptr)
+					success = false;
+				loadTimes.push_back(get_seconds(t) * 1'000.0);
+			}
+			auto indexArchiveSize = std::filesystem::file_size(indexArchivePath);
+			json.BeginObject("index_startup");
+			json.Write("entries", static_cast<uint64_t>(indexNames.size()));
+			json.Write("archive_size", static_cast<uint64_t>(indexArchiveSize));
+			json.Write("open_median_ms", get_median(openTimes));
+			json.Write("latest_version_median_ms", get_median(versionTimes));
+			json.Write("first_lookup_median_ms", get_median(lookupTimes));
+			json.Write("full_load_median_ms", get_median(loadTimes));
+			// The archive consists of nothing but metadata
+			json.Write("metadata_mb_per_second", get_rate(static_cast<double>(indexArchiveSize) / MB, get_median(loadTimes) / 1'000.0));
+
+			// Memory held by the archive once all of its metadata has been loaded
+			auto heapBefore = get_heap_usage();
+			auto indexArchive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(indexArchivePath));
+			if(indexArchive == nullptr || indexArchive->FindFile(indexNames.front()) == nullptr || indexArchive->GetVersions().empty())
+				success = false;
+			auto heapAfter = get_heap_usage();
+			if(heapBefore.has_value() && heapAfter.has_value()) {
+				auto heapBytes = (*heapAfter > *heapBefore) ? (*heapAfter - *heapBefore) : 0;
+				json.Write("heap_bytes", heapBytes);
+				json.Write("heap_bytes_per_entry", get_rate(static_cast<double>(heapBytes), static_cast<double>(indexNames.size())));
+			}
+			json.EndObject();
+		}
+		else
+			success = false;
+		std::filesystem::remove(indexArchivePath);
+	}
+	// Publish planning without any file I/O: Deduplicating the list, resolving the archive names, matching the files against
+	// the archive and detecting deleted files
+	json.BeginArray("publish_planning");
+	for(auto numEntries : config.planEntries) {
+		auto planArchivePath = (workDir / "planning.dat").string();
+		std::vector<pragma::uva::PublishInfo> files;
+		if(generate_planning_archive(config, numEntries, planArchivePath, files) == false) {
+			success = false;
+			std::filesystem::remove(planArchivePath);
+			continue;
+		}
+		auto numListed = files.size();
+		auto options = publishOptions;
+		options.exportMode = pragma::uva::ExportMode::Rewrite;
+		pragma::uva::ArchiveFile::UpdateResult result;
+		auto t = Clock::now();
+		{
+			ScopedSilence silence {};
+			util::Version version {};
+			result = pragma::uva::ArchiveFile::PublishUpdate(workDir.string(), version, files, planArchivePath, nullptr, nullptr, nullptr, options);
+		}
+		auto seconds = get_seconds(t);
+		if(result != pragma::uva::ArchiveFile::UpdateResult::NothingToUpdate)
+			success = false;
+		json.BeginObject();
+		json.Write("entries", static_cast<uint64_t>(numEntries));
+		json.Write("listed", static_cast<uint64_t>(numListed));
+		json.Write("result", pragma::uva::ArchiveFile::result_code_to_string(result));
+		json.Write("seconds", seconds);
+		json.Write("entries_per_second", get_rate(static_cast<double>(numListed), seconds));
+		json.EndObject();
+		std::filesystem::remove(planArchivePath);
+	}
+	json.EndArray();
+	json.Write("success", success);
+	json.EndObject();
+	std::cout << json.GetString() << std::endl;
+
+	if(config.keepFiles == false)
+		std::filesystem::remove_all(workDir);
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
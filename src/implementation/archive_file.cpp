@@ -3,17 +3,205 @@
 
 module;
 
-#include "bzlib_wrapper.hpp"
 #include <cstddef>
 
 module pragma.uva;
 
+import :thread_pool;
 import pragma.filesystem;
 
 #undef max
 
 const std::array<char, 5> ARCHIVE_IDENT = {'V', 'A', 'R', 'C', 'H'};
-const uint32_t ARCHIVE_VERSION = 1;
+// Version 2: Codec is stored in the file flags
+// Version 3: The metadata sections may follow the file data (see ExportMode::Append)
+// Version 4: File headers contain a content hash
+// Version 5: Solid blocks, file headers contain the position of the file in its block
+// Version 6: Chunked payloads
+// Version 7: File headers contain the size, modification time and inode of the source file
+const uint32_t ARCHIVE_VERSION = 7;
+
+// Upper bound for the intermediate buffers used when streaming file data
+static constexpr uint64_t DECOMPRESSION_CHUNK_SIZE = 1024 * 1024;
+
+static bool is_path_separator(char c) { return c == '/' || c == '\\'; }
+
+// Yields the characters of an archive path in normalized form (lower-case, '/' as separator, no empty
+// segments) one at a time, so paths can be hashed and compared without allocating.
+class NormalizedPathReader {
+  public:
+	NormalizedPathReader(std::string_view path) : m_path {path} { SkipSeparators(); }
+	// Returns -1 once the end of the path has been reached
+	int32_t Next()
+	{
+		if(m_pos >= m_path.size())
+			return -1;
+		auto c = m_path[m_pos++];
+		if(is_path_separator(c)) {
+			SkipSeparators();
+			return (m_pos < m_path.size()) ? '/' : -1;
+		}
+		return (c >= 'A' && c <= 'Z') ? (c - 'A' + 'a') : static_cast<unsigned char>(c);
+	}
+  private:
+	void SkipSeparators()
+	{
+		while(m_pos < m_path.size() && is_path_separator(m_path[m_pos]))
+			++m_pos;
+	}
+	std::string_view m_path;
+	size_t m_pos = 0;
+};
+
+static std::string normalize_path(std::string_view path)
+{
+	std::string npath;
+	npath.reserve(path.size());
+	NormalizedPathReader reader {path};
+	for(auto c = reader.Next(); c != -1; c = reader.Next())
+		npath += static_cast<char>(c);
+	return npath;
+}
+
+// '.' and '..' segments can only be resolved by canonicalizing the path
+static bool has_relative_segments(std::string_view path)
+{
+	size_t start = 0;
+	for(;;) {
+		auto end = path.find_first_of("/\\", start);
+		auto segment = path.substr(start, (end != std::string_view::npos) ? (end - start) : std::string_view::npos);
+		if(segment == "." || segment == "..")
+			return true;
+		if(end == std::string_view::npos)
+			return false;
+		start = end + 1;
+	}
+}
+
+// FNV-1a over the normalized path, can be continued to hash the path of a child entry
+static constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+static uint64_t hash_path(std::string_view path, uint64_t hash = FNV_OFFSET_BASIS)
+{
+	NormalizedPathReader reader {path};
+	for(auto c = reader.Next(); c != -1; c = reader.Next()) {
+		hash ^= static_cast<uint64_t>(c);
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+static uint64_t hash_child_path(uint64_t parentHash, bool parentIsRoot, std::string_view name)
+{
+	if(parentIsRoot)
+		return hash_path(name);
+	return hash_path(name, (parentHash ^ static_cast<uint64_t>('/')) * FNV_PRIME);
+}
+
+// Decodes the values of a metadata section that has been read in one piece. Reading past the end yields
+// zero-initialized values.
+class SectionReader {
+  public:
+	SectionReader(std::span<const uint8_t> data) : m_data {data} {}
+	template<typename T>
+	T Read()
+	{
+		T value {};
+		Read(&value, sizeof(value));
+		return value;
+	}
+	void Read(void *data, size_t size)
+	{
+		auto n = std::min(size, GetRemainingSize());
+		std::memcpy(data, m_data.data() + m_pos, n);
+		if(n < size)
+			std::memset(static_cast<uint8_t *>(data) + n, 0, size - n);
+		m_pos += n;
+	}
+	size_t GetRemainingSize() const { return m_data.size() - m_pos; }
+  private:
+	std::span<const uint8_t> m_data;
+	size_t m_pos = 0;
+};
+
+static bool name_equals(std::string_view a, std::string_view b)
+{
+	if(a.size() != b.size())
+		return false;
+	for(auto i = decltype(a.size()) {0}; i < a.size(); ++i) {
+		auto ca = (a[i] >= 'A' && a[i] <= 'Z') ? (a[i] - 'A' + 'a') : a[i];
+		auto cb = (b[i] >= 'A' && b[i] <= 'Z') ? (b[i] - 'A' + 'a') : b[i];
+		if(ca != cb)
+			return false;
+	}
+	return true;
+}
+
+void pragma::uva::ArchiveFile::Hierarchy::Resize(size_t size)
+{
+	parents.resize(size, INVALID_INDEX);
+	firstChildren.resize(size, INVALID_INDEX);
+	lastChildren.resize(size, INVALID_INDEX);
+	nextSiblings.resize(size, INVALID_INDEX);
+}
+
+void pragma::uva::ArchiveFile::Hierarchy::Link(uint32_t parent, uint32_t child)
+{
+	parents.at(child) = parent;
+	auto &last = lastChildren.at(parent);
+	if(last == INVALID_INDEX)
+		firstChildren.at(parent) = child;
+	else
+		nextSiblings.at(last) = child;
+	last = child;
+}
+
+std::string_view pragma::uva::ArchiveFile::NamePool::Add(std::string_view name)
+{
+	if(m_blocks.empty() || m_blockSize - m_blockUsed < name.size())
+		Reserve(name.size());
+	auto *data = m_blocks.back().get() + m_blockUsed;
+	std::memcpy(data, name.data(), name.size());
+	m_blockUsed += name.size();
+	return std::string_view {data, name.size()};
+}
+
+void pragma::uva::ArchiveFile::NamePool::AddBlock(std::unique_ptr<char[]> block, size_t size)
+{
+	// Keep the partially filled block at the end, so it can still be appended to
+	auto it = m_blocks.empty() ? m_blocks.end() : (m_blocks.end() - 1);
+	m_blocks.insert(it, std::move(block));
+	if(m_blocks.size() == 1)
+		m_blockSize = m_blockUsed = size;
+}
+
+void pragma::uva::ArchiveFile::NamePool::Reserve(size_t size)
+{
+	constexpr size_t BLOCK_SIZE = 64 * 1024;
+	if(m_blocks.empty() == false && m_blockSize - m_blockUsed >= size)
+		return;
+	m_blockSize = std::max(size, BLOCK_SIZE);
+	m_blockUsed = 0;
+	m_blocks.push_back(std::make_unique<char[]>(m_blockSize));
+}
+
+pragma::uva::ArchiveFile::FileIndexInfo::FileIndexInfo(const ArchiveFile &archive, uint32_t idx) : index {idx}, m_archive {&archive} {}
+bool pragma::uva::ArchiveFile::FileIndexInfo::HasParent() const { return index < m_archive->m_hierarchy.parents.size() && m_archive->m_hierarchy.parents.at(index) != INVALID_INDEX; }
+pragma::uva::ArchiveFile::FileIndexInfo pragma::uva::ArchiveFile::FileIndexInfo::GetParent() const { return FileIndexInfo {*m_archive, m_archive->m_hierarchy.parents.at(index)}; }
+pragma::uva::ArchiveFile::FileIndexInfo::ChildRange pragma::uva::ArchiveFile::FileIndexInfo::GetChildren() const
+{
+	auto &firstChildren = m_archive->m_hierarchy.firstChildren;
+	auto first = (index < firstChildren.size()) ? firstChildren.at(index) : INVALID_INDEX;
+	return ChildRange {ChildIterator {*m_archive, first}, ChildIterator {*m_archive, INVALID_INDEX}};
+}
+
+pragma::uva::ArchiveFile::FileIndexInfo::ChildIterator::ChildIterator(const ArchiveFile &archive, uint32_t index) : m_archive {&archive}, m_index {index} {}
+pragma::uva::ArchiveFile::FileIndexInfo pragma::uva::ArchiveFile::FileIndexInfo::ChildIterator::operator*() const { return FileIndexInfo {*m_archive, m_index}; }
+pragma::uva::ArchiveFile::FileIndexInfo::ChildIterator &pragma::uva::ArchiveFile::FileIndexInfo::ChildIterator::operator++()
+{
+	m_index = m_archive->m_hierarchy.nextSiblings.at(m_index);
+	return *this;
+}
+bool pragma::uva::ArchiveFile::FileIndexInfo::ChildIterator::operator==(const ChildIterator &other) const { return m_index == other.m_index; }
 
 bool pragma::uva::ArchiveFile::ReadHeader()
 {
@@ -23,124 +211,217 @@ bool pragma::uva::ArchiveFile::ReadHeader()
 	if(strncmp(ident.data(), ARCHIVE_IDENT.data(), ident.size()) != 0)
 		return false;
 	auto version = f->Read<uint32_t>();
+	if(version > ARCHIVE_VERSION)
+		return false;
+	m_version = version;
 
-	auto hdVersionOffset = f->Read<uint64_t>();
-	auto hdFileOffset = f->Read<uint64_t>();
-	auto hdFileNameOffset = f->Read<uint64_t>();
-	auto hdHierarchyOffset = f->Read<uint64_t>();
-	auto hdDataOffset = f->Read<uint64_t>();
-
+	SectionOffsets sections {};
+	sections.versions = f->Read<uint64_t>();
+	sections.files = f->Read<uint64_t>();
+	sections.fileNames = f->Read<uint64_t>();
+	sections.hierarchy = f->Read<uint64_t>();
+	sections.data = f->Read<uint64_t>();
+	m_sections = sections;
 	return true;
 }
 
-void pragma::uva::ArchiveFile::ReadVersionLayer()
+void pragma::uva::ArchiveFile::LoadVersionLayer() const
 {
-	auto &f = m_in;
-	if(f == nullptr)
-		return;
-	auto numVersions = f->Read<uint32_t>();
-	for(auto i = decltype(numVersions) {0}; i < numVersions; ++i) {
+	std::call_once(m_versionLayerLoaded, [this]() {
+		if(m_sections.has_value() == false || m_sections->files < m_sections->versions)
+			return;
+		std::vector<uint8_t> data(m_sections->files - m_sections->versions);
+		if(ReadSection(m_sections->versions, m_sections->files, data.data()))
+			ReadVersionLayer(data);
+	});
+}
+
+void pragma::uva::ArchiveFile::LoadFileLayer() const
+{
+	std::call_once(m_fileLayerLoaded, [this]() {
+		if(m_sections.has_value() == false || m_sections->fileNames < m_sections->files || m_sections->hierarchy < m_sections->fileNames)
+			return;
+		std::vector<uint8_t> data(m_sections->fileNames - m_sections->files);
+		if(ReadSection(m_sections->files, m_sections->fileNames, data.data()) == false)
+			return;
+		ReadFiles(data);
+
+		// The name section becomes part of the name pool as it is, so the names don't have to be copied
+		auto size = m_sections->hierarchy - m_sections->fileNames;
+		auto names = std::make_unique<char[]>(size);
+		if(ReadSection(m_sections->fileNames, m_sections->hierarchy, names.get()))
+			ReadFileNames(std::move(names), size);
+	});
+}
+
+void pragma::uva::ArchiveFile::LoadIndexLayer() const
+{
+	LoadFileLayer();
+	std::call_once(m_indexLayerLoaded, [this]() {
+		if(m_sections.has_value() == false)
+			return;
+		std::vector<uint8_t> data(m_files.size() * sizeof(uint32_t));
+		if(ReadSection(m_sections->hierarchy, m_sections->hierarchy + data.size(), data.data()) == false)
+			data.clear();
+		ReadFileHierarchy(data);
+		BuildPathIndex();
+	});
+}
+
+bool pragma::uva::ArchiveFile::ReadSection(uint64_t begin, uint64_t end, void *data) const
+{
+	if(end < begin)
+		return false;
+	auto size = end - begin;
+	if(m_nativeFile != nullptr)
+		return m_nativeFile->ReadAt(m_inFileStartOffset + begin, data, size);
+	if(m_in == nullptr)
+		return false;
+	std::scoped_lock lock {m_readMutex};
+	m_in->Seek(m_inFileStartOffset + begin);
+	return m_in->Read(data, size) == size;
+}
+
+void pragma::uva::ArchiveFile::ReadVersionLayer(std::span<const uint8_t> data) const
+{
+	SectionReader reader {data};
+	auto numVersions = reader.Read<uint32_t>();
+	for(auto i = decltype(numVersions) {0}; i < numVersions && reader.GetRemainingSize() > 0; ++i) {
 		VersionInfo info;
-		info.version = f->Read<util::Version>();
-		auto numFiles = f->Read<uint32_t>();
-		info.files.reserve(numFiles);
-		for(auto j = decltype(numFiles) {0}; j < numFiles; ++j) {
-			auto idxFile = f->Read<uint32_t>();
-			info.files.push_back(idxFile);
+		info.version = reader.Read<util::Version>();
+		auto numFiles = std::min<size_t>(reader.Read<uint32_t>(), reader.GetRemainingSize() / sizeof(uint32_t));
+		info.files.resize(numFiles);
+		reader.Read(info.files.data(), info.files.size() * sizeof(info.files.front()));
+		m_versions.push_back(std::move(info));
+	}
+	BuildVersionIndex();
+}
+
+void pragma::uva::ArchiveFile::BuildVersionIndex() const
+{
+	m_fileVersions.clear();
+	m_versionLiveCounts.clear();
+	// Newest first, so older versions that still list a file (e.g. in archives written by older builds) don't override it
+	for(auto &info : m_versions) {
+		auto &liveCount = m_versionLiveCounts[info.version];
+		for(auto idx : info.files) {
+			if(idx >= m_fileVersions.size())
+				m_fileVersions.resize(idx + 1);
+			if(m_fileVersions.at(idx).has_value() == false) {
+				m_fileVersions.at(idx) = info.version;
+				++liveCount;
+			}
 		}
-		m_versions.push_back(info);
 	}
 }
 
-void pragma::uva::ArchiveFile::ReadFiles()
+bool pragma::uva::ArchiveFile::IsCurrentVersionEntry(const VersionInfo &info, uint32_t idx) const { return idx < m_fileVersions.size() && m_fileVersions.at(idx) == info.version; }
+
+void pragma::uva::ArchiveFile::PruneVersion(VersionInfo &info)
 {
-	auto &f = m_in;
-	if(f == nullptr)
-		return;
-	auto numFiles = f->Read<uint32_t>();
-	m_files.reserve(numFiles);
-	for(auto i = decltype(numFiles) {0}; i < numFiles; ++i) {
-		m_files.push_back(std::make_shared<pragma::uva::FileInfo>());
-		auto &fi = m_files.back();
-		auto fh = f->Read<FileHeader>();
-		fi->flags = static_cast<pragma::uva::FileInfo::Flags>(fh.flags);
-		fi->size = fh.size;
-		fi->sizeUncompressed = fh.sizeUncompressed;
-		fi->offset = fh.offset;
-		fi->crc = fh.crc;
+	std::erase_if(info.files, [this, &info](uint32_t idx) { return IsCurrentVersionEntry(info, idx) == false; });
+	// Duplicates within the same version
+	if(info.files.size() > m_versionLiveCounts[info.version]) {
+		std::unordered_set<uint32_t> seen;
+		std::erase_if(info.files, [&seen](uint32_t idx) { return seen.insert(idx).second == false; });
 	}
 }
 
-void pragma::uva::ArchiveFile::ReadFileNames()
+void pragma::uva::ArchiveFile::PruneVersions()
 {
-	auto &f = m_in;
-	if(f == nullptr)
-		return;
-	for(auto &fi : m_files)
-		fi->name = f->ReadString();
+	LoadVersionLayer();
+	for(auto &info : m_versions) {
+		if(info.files.size() != m_versionLiveCounts[info.version])
+			PruneVersion(info);
+	}
 }
 
-void pragma::uva::ArchiveFile::ReadFileHierarchy()
+std::optional<util::Version> pragma::uva::ArchiveFile::GetFileVersion(uint32_t idx) const
 {
-	auto &f = m_in;
-	if(f == nullptr)
-		return;
-	std::vector<std::shared_ptr<FileIndexInfo>> fileIndexInfo(m_files.size(), nullptr);
-	for(auto i = decltype(m_files.size()) {0}; i < m_files.size(); ++i) {
-		auto parentId = f->Read<uint32_t>();
-		std::shared_ptr<FileIndexInfo> fiiParent = nullptr;
-		if(parentId == std::numeric_limits<decltype(parentId)>::max())
-			fiiParent = m_root;
-		else {
-			auto &fii = fileIndexInfo.at(parentId);
-			if(fii == nullptr) {
-				fii = std::make_shared<FileIndexInfo>();
-				fii->index = parentId;
-			}
-			fiiParent = fii;
-		}
-		auto &fiiChild = fileIndexInfo.at(i);
-		if(fiiChild == nullptr) {
-			if(i == 0)
-				fiiChild = m_root;
-			else {
-				fiiChild = std::make_shared<FileIndexInfo>();
-				fiiChild->index = i;
-			}
-		}
-		if(i != 0) // Don't add root as child of itself
-		{
-			fiiChild->parent = fiiParent;
-			fiiParent->children.push_back(fiiChild);
-		}
+	LoadVersionLayer();
+	if(idx >= m_fileVersions.size())
+		return {};
+	return m_fileVersions.at(idx);
+}
+
+void pragma::uva::ArchiveFile::ReadFiles(std::span<const uint8_t> data) const
+{
+	SectionReader reader {data};
+	auto headerSize = sizeof(FileHeader);
+	if(m_version < 4)
+		headerSize = offsetof(FileHeader, contentHash);
+	else if(m_version < 5)
+		headerSize = offsetof(FileHeader, blockOffset);
+	else if(m_version < 7)
+		headerSize = offsetof(FileHeader, sourceSize);
+	auto numFiles = std::min<size_t>(reader.Read<uint32_t>(), reader.GetRemainingSize() / headerSize);
+	m_files.resize(numFiles);
+	for(auto &fi : m_files) {
+		FileHeader fh {};
+		reader.Read(&fh, headerSize);
+		fi.flags = static_cast<pragma::uva::FileInfo::Flags>(fh.flags);
+		fi.size = fh.size;
+		fi.sizeUncompressed = fh.sizeUncompressed;
+		fi.offset = fh.offset;
+		fi.crc = fh.crc;
+		fi.contentHash = fh.contentHash;
+		fi.blockOffset = fh.blockOffset;
+		fi.blockSize = fh.blockSize;
+		fi.sourceStat = {fh.sourceSize, fh.sourceMtime, fh.sourceInode};
+	}
+}
+
+void pragma::uva::ArchiveFile::ReadFileNames(std::unique_ptr<char[]> data, size_t size) const
+{
+	// Null-terminated names in file order
+	size_t pos = 0;
+	for(auto &fi : m_files) {
+		if(pos >= size)
+			break;
+		auto len = std::find(data.get() + pos, data.get() + size, '\0') - (data.get() + pos);
+		fi.name = std::string_view {data.get() + pos, static_cast<size_t>(len)};
+		pos += len + 1;
+	}
+	m_names.AddBlock(std::move(data), size);
+}
+
+void pragma::uva::ArchiveFile::ReadFileHierarchy(std::span<const uint8_t> data) const
+{
+	m_hierarchy.Resize(m_files.size());
+	std::vector<uint32_t> parentIds(m_files.size(), 0);
+	SectionReader reader {data};
+	reader.Read(parentIds.data(), parentIds.size() * sizeof(parentIds.front()));
+	// Entry 0 is the root, linking in index order keeps the children sorted by index
+	for(auto i = decltype(parentIds.size()) {1}; i < parentIds.size(); ++i) {
+		auto parentId = parentIds.at(i);
+		if(parentId >= m_files.size())
+			parentId = 0;
+		m_hierarchy.Link(parentId, static_cast<uint32_t>(i));
 	}
-	/*std::function<void(FileIndexInfo&)> fReadHierarchy = nullptr;
-	fReadHierarchy = [&fReadHierarchy,&f](FileIndexInfo &fii) {
-		fii.index = f->Read<uint32_t>();
-		auto numChildren = f->Read<uint32_t>();
-		for(auto i=decltype(numChildren){0};i<numChildren;++i)
-		{
-			fii.children.push_back(std::make_shared<FileIndexInfo>());
-			fii.children.back()->parent = fii.shared_from_this();
-			fReadHierarchy(*fii.children.back());
-		}
-	};
-	fReadHierarchy(*m_root);*/
-	// New concept:
-	// Use table
-	// [fileId] = parentId
 }
 
 void pragma::uva::ArchiveFile::ReadFileData(uint64_t startOffset, const pragma::uva::FileInfo &fi, std::vector<uint8_t> &data) const
 {
+	data.resize(fi.size);
+	if(ReadFileData(startOffset, fi, 0, data) == false)
+		data.clear();
+}
+
+bool pragma::uva::ArchiveFile::ReadFileData(uint64_t startOffset, const pragma::uva::FileInfo &fi, uint64_t offset, std::span<uint8_t> data) const
+{
+	if(offset + data.size() > fi.size)
+		return false;
+	if(m_nativeFile != nullptr)
+		return m_nativeFile->ReadAt(startOffset + fi.offset + offset, data.data(), data.size());
 	auto &f = m_in;
 	if(f == nullptr)
-		return;
-	auto offset = f->Tell();
-	f->Seek(startOffset + fi.offset);
-	data.resize(fi.size);
-	f->Read(data.data(), data.size());
-	f->Seek(offset);
+		return false;
+	std::scoped_lock lock {m_readMutex};
+	auto curOffset = f->Tell();
+	f->Seek(startOffset + fi.offset + offset);
+	auto numRead = f->Read(data.data(), data.size());
+	f->Seek(curOffset);
+	return numRead == data.size();
 }
 
 static void write_offset(const VFilePtrReal &f, uint64_t startOffset, uint64_t offsetToOffsetLocation)
@@ -171,6 +452,7 @@ void pragma::uva::ArchiveFile::WriteHeader(uint64_t &hdVersionOffset, uint64_t &
 
 void pragma::uva::ArchiveFile::WriteVersionLayer()
 {
+	PruneVersions();
 	auto &f = m_out;
 	f->Write<uint32_t>(static_cast<uint32_t>(m_versions.size()));
 	for(auto &info : m_versions) {
@@ -183,117 +465,370 @@ void pragma::uva::ArchiveFile::WriteVersionLayer()
 
 void pragma::uva::ArchiveFile::WriteFiles(uint64_t &fileHeaderOffset)
 {
+	// The headers are only written once the names and payloads have been placed, see WriteFileHeaders
 	auto &f = m_out;
 	f->Write<uint32_t>(m_files.size());
 	fileHeaderOffset = f->Tell();
-	for(auto &fi : m_files) {
-		FileHeader fh {};
-		fh.flags = umath::to_integral(fi->flags);
-		fh.size = fi->size;
-		fh.sizeUncompressed = fi->sizeUncompressed;
-		fh.crc = fi->crc;
-		f->Write<FileHeader>(fh);
-	}
+	std::vector<FileHeader> placeholders(m_files.size());
+	f->Write(placeholders.data(), placeholders.size() * sizeof(FileHeader));
 }
 
-void pragma::uva::ArchiveFile::WriteFileNames(uint64_t startOffset, uint64_t fileHeaderOffset)
+void pragma::uva::ArchiveFile::WriteFileNames(uint64_t startOffset, std::vector<FileHeader> &headers)
 {
 	auto &f = m_out;
 	for(auto i = decltype(m_files.size()) {0}; i < m_files.size(); ++i) {
-		write_offset(f, startOffset, fileHeaderOffset + sizeof(FileHeader) * i + offsetof(FileHeader, fileNameOffset));
-		auto &fi = m_files.at(i);
-		f->WriteString(fi->name);
+		headers.at(i).fileNameOffset = f->Tell() - startOffset;
+		f->WriteString(std::string {m_files.at(i).name});
 	}
 }
 
+void pragma::uva::ArchiveFile::WriteFileHeaders(uint64_t fileHeaderOffset, const std::vector<FileHeader> &headers)
+{
+	auto &f = m_out;
+	auto offset = f->Tell();
+	f->Seek(fileHeaderOffset);
+	f->Write(headers.data(), headers.size() * sizeof(FileHeader));
+	f->Seek(offset);
+}
+
 void pragma::uva::ArchiveFile::WriteFileHierarchy()
 {
 	auto &f = m_out;
-	std::vector<uint32_t> parentIds(m_files.size(), std::numeric_limits<uint32_t>::max());
-	std::function<void(FileIndexInfo &)> fIterateHierarchy = nullptr;
-	fIterateHierarchy = [&fIterateHierarchy, &parentIds](FileIndexInfo &fii) {
-		auto parentId = std::numeric_limits<uint32_t>::max();
-		if(fii.parent.expired() == false)
-			parentId = fii.parent.lock()->index;
-		parentIds.at(fii.index) = parentId;
-
-		for(auto &child : fii.children)
-			fIterateHierarchy(*child);
-	};
-	fIterateHierarchy(*m_root);
-
-	for(auto idx : parentIds)
-		f->Write<uint32_t>(idx);
-	/*std::function<void(FileIndexInfo&)> fWriteHierarchy = nullptr;
-	fWriteHierarchy = [&fWriteHierarchy,&f](FileIndexInfo &fii) {
-		f->Write<uint32_t>(fii.index);
-		f->Write<uint32_t>(fii.children.size());
-		for(auto &child : fii.children)
-			fWriteHierarchy(*child);
-	};
-	fWriteHierarchy(*m_root);*/
-	/*f->Write<uint32_t>(static_cast<uint32_t>(m_fileInfo.size()));
-	for(auto &info : m_fileInfo)
-	{
-		f->WriteString(info.name);
-		f->Write<uint8_t>(static_cast<uint8_t>(info.os));
-		f->Write<uint64_t>(info.size);
-		if(info.size > 0)
-		{
-			f->Write<uint64_t>(info.sizeUncompressed);
-			info.offsetToStringTable = f->Tell();
-			f->Write<uint64_t>(info.offset);
-			f->Write<uint32_t>(info.crc);
-		}
-	}*/
+	f->Write(m_hierarchy.parents.data(), m_hierarchy.parents.size() * sizeof(m_hierarchy.parents.front()));
 }
 
-void pragma::uva::ArchiveFile::WriteFileData(uint64_t startOffset, uint64_t fileHeaderOffset)
+void pragma::uva::ArchiveFile::WriteFileData(uint64_t startOffset, std::vector<FileHeader> &headers, std::vector<std::pair<uint32_t, FileInfo>> &outStagedFiles, const PayloadProvider &payloadProvider, bool keepExistingPayloads, NativeFile *outFile)
 {
+	std::vector<uint8_t> payload;
+	std::vector<uint8_t> copyBuffer;
+	// Existing payloads that are stored back to back are coalesced and copied as a single range
+	struct CopyRange {
+		uint64_t srcOffset = 0;
+		uint64_t dstOffset = 0;
+		uint64_t size = 0;
+	} copyRange {};
+	auto fFlushCopyRange = [this, outFile, &copyRange, &copyBuffer]() {
+		if(copyRange.size == 0)
+			return;
+		if(outFile->CopyFrom(*m_nativeFile, m_inFileStartOffset + copyRange.srcOffset, copyRange.dstOffset, copyRange.size, copyBuffer) == false)
+			std::cout << "WARNING: Unable to copy " << copyRange.size << " bytes of existing file data!" << std::endl;
+		m_out->Seek(copyRange.dstOffset + copyRange.size);
+		copyRange = {};
+	};
+	// Payloads with the same content are only stored once, all files with that content share the offset of the first one
+	std::unordered_map<uint64_t, const FileHeader *> payloadsByHash;
+	auto fFindPayload = [&payloadsByHash](const FileHeader &fh) -> const FileHeader * {
+		if(fh.contentHash == 0)
+			return nullptr;
+		auto it = payloadsByHash.find(fh.contentHash);
+		if(it == payloadsByHash.end())
+			return nullptr;
+		auto &other = *it->second;
+		auto layoutMask = umath::to_integral(FileInfo::Flags::CodecMask | FileInfo::Flags::Chunked);
+		if(other.size != fh.size || other.sizeUncompressed != fh.sizeUncompressed || other.crc != fh.crc || (other.flags & layoutMask) != (fh.flags & layoutMask))
+			return nullptr;
+		return &other;
+	};
+	// Files of a solid block share its payload, which is only written for the first of them. Blocks that haven't been
+	// written yet are identified by their data, existing ones by their offset.
+	std::unordered_map<const void *, uint64_t> newBlockOffsets;
+	std::unordered_map<uint64_t, uint64_t> blockOffsets;
+	auto fFindBlock = [&newBlockOffsets, &blockOffsets](const FileInfo &fi) -> std::optional<uint64_t> {
+		if(fi.data != nullptr) {
+			auto it = newBlockOffsets.find(fi.data.get());
+			return (it != newBlockOffsets.end()) ? it->second : std::optional<uint64_t> {};
+		}
+		auto it = blockOffsets.find(fi.offset);
+		return (it != blockOffsets.end()) ? it->second : std::optional<uint64_t> {};
+	};
+	auto fAddBlock = [&newBlockOffsets, &blockOffsets](const FileInfo &fi, uint64_t offset) {
+		if(fi.data != nullptr)
+			newBlockOffsets[fi.data.get()] = offset;
+		else
+			blockOffsets[fi.offset] = offset;
+	};
+	// Everything but the offset, which depends on where the payload ends up
+	auto fFillHeader = [](const FileInfo &fi, FileHeader &fh) {
+		fh.flags = umath::to_integral(fi.flags);
+		fh.size = fi.size;
+		fh.sizeUncompressed = fi.sizeUncompressed;
+		fh.crc = fi.crc;
+		fh.contentHash = fi.contentHash;
+		fh.blockOffset = fi.blockOffset;
+		fh.blockSize = fi.blockSize;
+		fh.sourceSize = fi.sourceStat.size;
+		fh.sourceMtime = fi.sourceStat.mtime;
+		fh.sourceInode = fi.sourceStat.inode;
+	};
 	for(auto i = decltype(m_files.size()) {0}; i < m_files.size(); ++i) {
-		auto &fi = m_files.at(i);
-		if(fi->size == 0)
+		const auto &current = m_files.at(i);
+		auto &fh = headers.at(i);
+		if(current.IsSolid() && current.size > 0) {
+			if(auto offset = fFindBlock(current)) {
+				fFillHeader(current, fh);
+				fh.offset = *offset;
+				continue;
+			}
+		}
+		// The provider updates a copy of the entry, the caller only applies it once the export has succeeded
+		auto hasPayload = false;
+		if(payloadProvider != nullptr) {
+			auto staged = current;
+			if(payloadProvider(static_cast<uint32_t>(i), staged, payload)) {
+				staged.size = payload.size();
+				staged.data = nullptr;
+				outStagedFiles.emplace_back(static_cast<uint32_t>(i), std::move(staged));
+				hasPayload = true;
+			}
+		}
+		const auto &fi = hasPayload ? outStagedFiles.back().second : current;
+		fFillHeader(fi, fh);
+		if(fi.size == 0)
+			continue;
+		if(fi.IsSolid() == false) {
+			if(auto *other = fFindPayload(fh)) {
+				fh.offset = other->offset;
+				continue;
+			}
+			if(fh.contentHash != 0)
+				payloadsByHash[fh.contentHash] = &fh;
+		}
+		if(keepExistingPayloads && hasPayload == false && fi.data == nullptr) {
+			fh.offset = fi.offset;
+			if(fi.IsSolid())
+				fAddBlock(fi, fh.offset);
 			continue;
-		write_offset(m_out, startOffset, fileHeaderOffset + sizeof(FileHeader) * i + offsetof(FileHeader, offset));
-		if(fi->data != nullptr)
-			m_out->Write(fi->data->data(), fi->size);
-		else if(m_in != nullptr) {
-			m_in->Seek(m_inFileStartOffset + fi->offset); // Old offset
-			std::vector<uint8_t> data(fi->size);
-			m_in->Read(data.data(), fi->size);
-			m_out->Write(data.data(), fi->size);
+		}
+		if(hasPayload == false && fi.data == nullptr && outFile != nullptr && m_nativeFile != nullptr) {
+			if(copyRange.size > 0 && copyRange.srcOffset + copyRange.size != fi.offset)
+				fFlushCopyRange();
+			if(copyRange.size == 0) {
+				// Seeking flushes the buffered output, which has to reach the file before it is written to directly
+				auto offset = m_out->Tell();
+				m_out->Seek(offset);
+				copyRange = {fi.offset, offset, 0};
+			}
+			fh.offset = copyRange.dstOffset + copyRange.size - startOffset;
+			copyRange.size += fi.size;
+			if(fi.IsSolid())
+				fAddBlock(fi, fh.offset);
+			continue;
+		}
+		fFlushCopyRange();
+		fh.offset = m_out->Tell() - startOffset;
+		if(fi.IsSolid() && hasPayload == false)
+			fAddBlock(fi, fh.offset);
+		if(hasPayload)
+			m_out->Write(payload.data(), payload.size());
+		else if(fi.data != nullptr)
+			m_out->Write(fi.data->data(), fi.size);
+		else if(auto data = GetCompressedData(fi); data.empty() == false)
+			m_out->Write(data.data(), data.size());
+		else {
+			// Copy the existing payload in chunks, so memory usage doesn't depend on the file size
+			copyBuffer.resize(std::min<uint64_t>(fi.size, DECOMPRESSION_CHUNK_SIZE));
+			for(uint64_t offset = 0; offset < fi.size;) {
+				auto n = std::min<uint64_t>(fi.size - offset, copyBuffer.size());
+				if(ReadFileData(m_inFileStartOffset, fi, offset, std::span<uint8_t> {copyBuffer.data(), n}) == false) {
+					std::cout << "WARNING: Unable to read payload of file '" << fi.name << "'!" << std::endl;
+					break;
+				}
+				m_out->Write(copyBuffer.data(), n);
+				offset += n;
+			}
 		}
 	}
+	fFlushCopyRange();
 }
 
-pragma::uva::ArchiveFile *pragma::uva::ArchiveFile::Open(const std::string &updateFileName, const std::function<bool(VFilePtr &)> &readCallback, const std::function<bool(VFilePtrReal &)> &writeCallback)
+pragma::uva::ArchiveFile *pragma::uva::ArchiveFile::Open(const std::string &updateFileName, const std::function<bool(VFilePtr &)> &readCallback, const std::function<bool(VFilePtrReal &)> &writeCallback, OpenFlags flags)
 {
+	auto systemPath = updateFileName;
 	auto in = FileManager::OpenFile<VFilePtrReal>(updateFileName.c_str(), "rb");
 	if(in == nullptr)
 		in = FileManager::OpenSystemFile(updateFileName.c_str(), "rb");
-	return new ArchiveFile(updateFileName, in, readCallback, writeCallback);
+	else
+		systemPath = FileManager::GetProgramPath() + FileManager::GetDirectorySeparator() + updateFileName;
+	return new ArchiveFile(updateFileName, systemPath, in, readCallback, writeCallback, flags);
 }
 
-pragma::uva::ArchiveFile::ArchiveFile(const std::string &updateFileName, VFilePtrReal &f, const std::function<bool(VFilePtr &)> &readCallback, const std::function<bool(VFilePtrReal &)> &writeCallback)
-    : m_in(f), m_out(nullptr), m_updateFile(updateFileName), m_fReadCallback(readCallback), m_fWriteCallback(writeCallback)
+pragma::uva::ArchiveFile::ArchiveFile(const std::string &updateFileName, const std::string &systemPath, VFilePtrReal &f, const std::function<bool(VFilePtr &)> &readCallback, const std::function<bool(VFilePtrReal &)> &writeCallback, OpenFlags flags)
+    : m_in(f), m_out(nullptr), m_updateFile(updateFileName), m_systemPath(systemPath), m_openFlags(flags), m_fReadCallback(readCallback), m_fWriteCallback(writeCallback)
 {
-	m_root = std::make_shared<FileIndexInfo>();
-
 	if(m_in == nullptr) {
-		m_files.push_back(std::make_shared<pragma::uva::FileInfo>());
-		auto &fi = m_files.back();
-		fi->flags |= pragma::uva::FileInfo::Flags::Directory;
+		m_files.push_back({});
+		m_files.back().flags |= pragma::uva::FileInfo::Flags::Directory;
+		m_hierarchy.Resize(1);
 		return;
 	}
+	auto *rawIn = m_in.get();
 	if(m_fReadCallback != nullptr && m_fReadCallback(m_in) == false)
 		return;
 	auto startOffset = m_inFileStartOffset = m_in->Tell();
 	if(ReadHeader() == false)
 		return;
-	ReadVersionLayer();
-	ReadFiles();
-	ReadFileNames();
-	ReadFileHierarchy();
+
+	// The native handle reads the file as it is on disk, which is only valid if the read callback didn't substitute the stream
+	if(m_in.get() == rawIn)
+		OpenNativeFile();
+}
+
+void pragma::uva::ArchiveFile::OpenNativeFile()
+{
+	m_nativeFile = NativeFile::Open(m_systemPath);
+	if(m_nativeFile != nullptr && (m_openFlags & OpenFlags::MemoryMapped) != OpenFlags::None)
+		m_nativeFile->Map();
+}
+
+void pragma::uva::ArchiveFile::SetBlockCacheSize(uint64_t size) { m_blockCache.SetCapacity(size); }
+
+pragma::uva::ArchiveFile::CacheStats pragma::uva::ArchiveFile::GetBlockCacheStats() const { return m_blockCache.GetStats(); }
+void pragma::uva::ArchiveFile::SetDataCacheSize(uint64_t size) { m_dataCache.SetCapacity(size); }
+pragma::uva::ArchiveFile::CacheStats pragma::uva::ArchiveFile::GetDataCacheStats() const { return m_dataCache.GetStats(); }
+
+pragma::uva::ArchiveFile::DataCache::DataCache(uint64_t capacity) : m_capacity {capacity} {}
+
+bool pragma::uva::ArchiveFile::DataCache::IsEnabled() const { return m_capacity > 0; }
+
+std::shared_ptr<const std::vector<uint8_t>> pragma::uva::ArchiveFile::DataCache::Find(uint64_t key)
+{
+	if(IsEnabled() == false)
+		return nullptr;
+	std::scoped_lock lock {m_mutex};
+	auto it = m_entryIndex.find(key);
+	if(it == m_entryIndex.end()) {
+		++m_stats.misses;
+		return nullptr;
+	}
+	++m_stats.hits;
+	m_entries.splice(m_entries.begin(), m_entries, it->second);
+	return it->second->second;
+}
+
+std::shared_ptr<const std::vector<uint8_t>> pragma::uva::ArchiveFile::DataCache::Peek(uint64_t key) const
+{
+	if(IsEnabled() == false)
+		return nullptr;
+	std::scoped_lock lock {m_mutex};
+	auto it = m_entryIndex.find(key);
+	return (it != m_entryIndex.end()) ? it->second->second : nullptr;
+}
+
+void pragma::uva::ArchiveFile::DataCache::Add(uint64_t key, const std::shared_ptr<const std::vector<uint8_t>> &data)
+{
+	std::scoped_lock lock {m_mutex};
+	if(data->size() > m_capacity || m_entryIndex.find(key) != m_entryIndex.end())
+		return;
+	m_entries.emplace_front(key, data);
+	m_entryIndex[key] = m_entries.begin();
+	m_stats.size += data->size();
+	Evict();
+}
+
+void pragma::uva::ArchiveFile::DataCache::SetCapacity(uint64_t capacity)
+{
+	std::scoped_lock lock {m_mutex};
+	m_capacity = capacity;
+	Evict();
+}
+
+pragma::uva::ArchiveFile::CacheStats pragma::uva::ArchiveFile::DataCache::GetStats() const
+{
+	std::scoped_lock lock {m_mutex};
+	auto stats = m_stats;
+	stats.capacity = m_capacity;
+	return stats;
+}
+
+void pragma::uva::ArchiveFile::DataCache::Clear()
+{
+	std::scoped_lock lock {m_mutex};
+	m_entries.clear();
+	m_entryIndex.clear();
+	m_stats.size = 0;
+}
+
+void pragma::uva::ArchiveFile::DataCache::Evict()
+{
+	while(m_stats.size > m_capacity && m_entries.empty() == false) {
+		auto &[key, data] = m_entries.back();
+		m_stats.size -= data->size();
+		++m_stats.evictions;
+		m_entryIndex.erase(key);
+		m_entries.pop_back();
+	}
+}
+
+bool pragma::uva::ArchiveFile::IsMemoryMapped() const { return m_nativeFile != nullptr && m_nativeFile->IsMapped(); }
+
+std::span<const uint8_t> pragma::uva::ArchiveFile::GetCompressedData(const FileInfo &fi) const
+{
+	if(m_nativeFile == nullptr || fi.size == 0)
+		return {};
+	return m_nativeFile->GetMappedRange(m_inFileStartOffset + fi.offset, fi.size);
+}
+
+void pragma::uva::ArchiveFile::BuildPathIndex() const
+{
+	m_pathIndex.clear();
+	m_pathIndex.reserve(m_files.size());
+	std::function<void(uint32_t, uint64_t)> fIndexHierarchy = nullptr;
+	fIndexHierarchy = [this, &fIndexHierarchy](uint32_t parent, uint64_t parentHash) {
+		for(auto child = m_hierarchy.firstChildren.at(parent); child != INVALID_INDEX; child = m_hierarchy.nextSiblings.at(child)) {
+			auto hash = hash_child_path(parentHash, parent == 0, m_files.at(child).name);
+			m_pathIndex.emplace(hash, child);
+			fIndexHierarchy(child, hash);
+		}
+	};
+	if(m_files.empty() == false)
+		fIndexHierarchy(0, FNV_OFFSET_BASIS);
+}
+
+uint32_t pragma::uva::ArchiveFile::LookupPath(const std::string &fname) const
+{
+	LoadIndexLayer();
+	std::string_view path = fname;
+	std::string canonicalPath;
+	if(has_relative_segments(fname)) {
+		canonicalPath = FileManager::GetCanonicalizedPath(fname);
+		path = canonicalPath;
+	}
+	auto [itBegin, itEnd] = m_pathIndex.equal_range(hash_path(path));
+	for(auto it = itBegin; it != itEnd; ++it) {
+		if(MatchesPath(it->second, path))
+			return it->second;
+	}
+	return INVALID_INDEX;
+}
+
+uint32_t pragma::uva::ArchiveFile::FindChild(uint32_t parent, uint64_t pathHash, std::string_view name) const
+{
+	auto [itBegin, itEnd] = m_pathIndex.equal_range(pathHash);
+	for(auto it = itBegin; it != itEnd; ++it) {
+		if(m_hierarchy.parents.at(it->second) == parent && name_equals(m_files.at(it->second).name, name))
+			return it->second;
+	}
+	return INVALID_INDEX;
+}
+
+bool pragma::uva::ArchiveFile::MatchesPath(uint32_t idx, std::string_view path) const
+{
+	// Compare the path segments back to front with the names along the parent chain
+	auto end = path.size();
+	for(;;) {
+		while(end > 0 && is_path_separator(path[end - 1]))
+			--end;
+		if(idx == 0 || idx == INVALID_INDEX)
+			return end == 0;
+		if(end == 0)
+			return false;
+		auto start = path.find_last_of("/\\", end - 1);
+		start = (start != std::string_view::npos) ? (start + 1) : 0;
+		if(name_equals(path.substr(start, end - start), m_files.at(idx).name) == false)
+			return false;
+		end = start;
+		idx = m_hierarchy.parents.at(idx);
+	}
 }
 
 pragma::uva::ArchiveFile::~ArchiveFile()
@@ -308,16 +843,244 @@ VFilePtr &pragma::uva::ArchiveFile::GetFile() { return m_in; }
 
 void pragma::uva::ArchiveFile::GetUpdateFiles(const util::Version &version, std::vector<uint32_t> &updateFiles) const
 {
+	LoadVersionLayer();
+	LoadFileLayer();
+	// The versions that are newer than 'version' are at the front
+	std::vector<uint32_t> files;
 	for(auto &versionOther : m_versions) {
 		if(version >= versionOther.version)
 			break;
-		updateFiles.reserve(updateFiles.size() + versionOther.files.size());
-		for(auto idx : versionOther.files)
-			updateFiles.push_back(idx);
+		for(auto idx : versionOther.files) {
+			if(IsCurrentVersionEntry(versionOther, idx))
+				files.push_back(idx);
+		}
+	}
+	auto fGetOffset = [this](uint32_t idx) { return (idx < m_files.size()) ? m_files.at(idx).offset : std::numeric_limits<uint64_t>::max(); };
+	std::sort(files.begin(), files.end(), [&fGetOffset](uint32_t a, uint32_t b) {
+		auto offsetA = fGetOffset(a);
+		auto offsetB = fGetOffset(b);
+		return (offsetA != offsetB) ? (offsetA < offsetB) : (a < b);
+	});
+	files.erase(std::unique(files.begin(), files.end()), files.end());
+	updateFiles.insert(updateFiles.end(), files.begin(), files.end());
+}
+bool pragma::uva::ArchiveFile::Export(ExportMode mode) { return Export(nullptr, mode); }
+
+std::vector<bool> pragma::uva::ArchiveFile::GetLiveEntries() const
+{
+	// Files are live if they have a payload, directories if any of their descendants is live
+	std::vector<bool> live(m_files.size(), false);
+	std::function<bool(uint32_t)> fMarkLive = nullptr;
+	fMarkLive = [this, &live, &fMarkLive](uint32_t idx) -> bool {
+		auto &fi = m_files.at(idx);
+		auto isLive = fi.IsFile() && (fi.size > 0 || fi.data != nullptr);
+		for(auto child = m_hierarchy.firstChildren.at(idx); child != INVALID_INDEX; child = m_hierarchy.nextSiblings.at(child)) {
+			if(fMarkLive(child))
+				isLive = true;
+		}
+		live.at(idx) = isLive;
+		return isLive;
+	};
+	if(m_files.empty() == false) {
+		fMarkLive(0);
+		live.at(0) = true; // Root
+	}
+	return live;
+}
+
+double pragma::uva::ArchiveFile::SpaceStats::GetDeadRatio() const { return (archiveSize > 0) ? (static_cast<double>(deadBytes) / static_cast<double>(archiveSize)) : 0.0; }
+
+pragma::uva::ArchiveFile::SpaceStats pragma::uva::ArchiveFile::GetSpaceStats() const
+{
+	LoadIndexLayer();
+	SpaceStats stats {};
+	if(m_sections.has_value() == false)
+		return stats;
+	uint64_t fileSize = 0;
+	if(m_nativeFile != nullptr)
+		fileSize = m_nativeFile->GetSize();
+	else if(m_in != nullptr) {
+		std::scoped_lock lock {m_readMutex};
+		fileSize = m_in->GetSize();
+	}
+	stats.archiveSize = (fileSize > m_inFileStartOffset) ? (fileSize - m_inFileStartOffset) : 0;
+
+	// The metadata is followed by the data section, unless it has been appended, in which case it extends to the end of the file
+	auto headerSize = ARCHIVE_IDENT.size() + sizeof(uint32_t) + 5 * sizeof(uint64_t);
+	auto metadataEnd = (m_sections->data > m_sections->versions) ? m_sections->data : stats.archiveSize;
+	stats.metadataBytes = headerSize + ((metadataEnd > m_sections->versions) ? (metadataEnd - m_sections->versions) : 0);
+
+	auto live = GetLiveEntries();
+	stats.numEntries = static_cast<uint32_t>(m_files.size());
+	// Deduplicated payloads are shared between files and only count once
+	std::unordered_set<uint64_t> liveOffsets;
+	for(auto i = decltype(m_files.size()) {0}; i < m_files.size(); ++i) {
+		auto &fi = m_files.at(i);
+		if(live.at(i) == false) {
+			++stats.numDeadEntries;
+			continue;
+		}
+		if(fi.IsFile() && fi.data == nullptr && fi.size > 0 && liveOffsets.insert(fi.offset).second)
+			stats.liveBytes += fi.size;
+	}
+	auto usedBytes = stats.metadataBytes + stats.liveBytes;
+	stats.deadBytes = (stats.archiveSize > usedBytes) ? (stats.archiveSize - usedBytes) : 0;
+	return stats;
+}
+
+bool pragma::uva::ArchiveFile::Compact(const CompactOptions &options)
+{
+	LoadVersionLayer();
+	LoadIndexLayer();
+	if(m_files.empty())
+		return Export(ExportMode::Rewrite);
+
+	// Renumber the entries in depth-first order, without the dead ones
+	std::vector<bool> live;
+	if(options.removeDeletedEntries)
+		live = GetLiveEntries();
+	else
+		live.resize(m_files.size(), true);
+	std::vector<uint32_t> newIndices(m_files.size(), INVALID_INDEX);
+	std::vector<uint32_t> order;
+	order.reserve(m_files.size());
+	std::function<void(uint32_t)> fAssignIndices = nullptr;
+	fAssignIndices = [this, &live, &newIndices, &order, &fAssignIndices](uint32_t idx) {
+		newIndices.at(idx) = static_cast<uint32_t>(order.size());
+		order.push_back(idx);
+		for(auto child = m_hierarchy.firstChildren.at(idx); child != INVALID_INDEX; child = m_hierarchy.nextSiblings.at(child)) {
+			if(live.at(child))
+				fAssignIndices(child);
+		}
+	};
+	fAssignIndices(0);
+
+	std::vector<FileInfo> files;
+	files.reserve(order.size());
+	NamePool names;
+	Hierarchy hierarchy;
+	hierarchy.Resize(order.size());
+	for(auto i = decltype(order.size()) {0}; i < order.size(); ++i) {
+		auto oldIdx = order.at(i);
+		files.push_back(m_files.at(oldIdx));
+		files.back().name = names.Add(m_files.at(oldIdx).name);
+		if(i > 0)
+			hierarchy.Link(newIndices.at(m_hierarchy.parents.at(oldIdx)), static_cast<uint32_t>(i));
+	}
+	PruneVersions();
+	auto versions = m_versions;
+	for(auto &version : versions) {
+		std::vector<uint32_t> versionFiles;
+		versionFiles.reserve(version.files.size());
+		for(auto idx : version.files) {
+			if(idx < newIndices.size() && newIndices.at(idx) != INVALID_INDEX)
+				versionFiles.push_back(newIndices.at(idx));
+		}
+		version.files = std::move(versionFiles);
+	}
+	// Versions whose files have all been removed from the index are dropped. The latest version is kept regardless,
+	// since it determines the version of the archive.
+	if(versions.empty() == false)
+		versions.erase(std::remove_if(versions.begin() + 1, versions.end(), [](const VersionInfo &version) { return version.files.empty(); }), versions.end());
+
+	// The payloads are still read from their old offsets during the export. Restore the previous index if it fails.
+	std::swap(files, m_files);
+	std::swap(names, m_names);
+	std::swap(hierarchy, m_hierarchy);
+	std::swap(versions, m_versions);
+	BuildVersionIndex();
+	if(Export(ExportMode::Rewrite) == false) {
+		std::swap(files, m_files);
+		std::swap(names, m_names);
+		std::swap(hierarchy, m_hierarchy);
+		std::swap(versions, m_versions);
+		BuildVersionIndex();
+		return false;
 	}
+	BuildPathIndex();
+	return true;
+}
+
+bool pragma::uva::ArchiveFile::CanAppend() const
+{
+	// The native handle is only available if the archive exists on disk and the read callback didn't substitute the stream.
+	// Appending writes to the file directly, so it also has to be bypassed by a write callback.
+	return m_sections.has_value() && m_nativeFile != nullptr && m_fWriteCallback == nullptr;
 }
-bool pragma::uva::ArchiveFile::Export()
+
+bool pragma::uva::ArchiveFile::ExportAppend(const PayloadProvider &payloadProvider)
 {
+	// Release the mapping before the file grows, the new payloads don't have to be read from the archive
+	m_nativeFile = nullptr;
+	auto f = FileManager::OpenSystemFile(m_systemPath.c_str(), "r+b");
+	if(f == nullptr) {
+		OpenNativeFile();
+		return false;
+	}
+	m_out = f;
+	auto startOffset = m_inFileStartOffset;
+	f->Seek(f->GetSize());
+
+	std::vector<FileHeader> headers(m_files.size());
+	std::vector<std::pair<uint32_t, FileInfo>> stagedFiles;
+	WriteFileData(startOffset, headers, stagedFiles, payloadProvider, true);
+
+	SectionOffsets sections {};
+	sections.data = m_sections->data;
+	sections.versions = f->Tell() - startOffset;
+	WriteVersionLayer();
+
+	sections.files = f->Tell() - startOffset;
+	uint64_t fileHeaderOffset = 0;
+	WriteFiles(fileHeaderOffset);
+
+	sections.fileNames = f->Tell() - startOffset;
+	WriteFileNames(startOffset, headers);
+
+	sections.hierarchy = f->Tell() - startOffset;
+	WriteFileHierarchy();
+	WriteFileHeaders(fileHeaderOffset, headers);
+	m_out = nullptr;
+	f = nullptr;
+
+	// Only repoint the header once everything else has reached the disk, until then the archive remains in its previous state.
+	// Without the first sync the header could be persisted before the data it points to.
+	auto outFile = NativeFile::Open(m_systemPath, NativeFile::Mode::ReadWrite);
+	auto r = (outFile != nullptr && outFile->Sync());
+	if(r) {
+		uint32_t version = ARCHIVE_VERSION;
+		std::array<uint64_t, 5> offsets {sections.versions, sections.files, sections.fileNames, sections.hierarchy, sections.data};
+		std::array<uint8_t, sizeof(version) + sizeof(offsets)> header;
+		std::memcpy(header.data(), &version, sizeof(version));
+		std::memcpy(header.data() + sizeof(version), offsets.data(), sizeof(offsets));
+		r = outFile->WriteAt(startOffset + ARCHIVE_IDENT.size(), header.data(), header.size()) && outFile->Sync();
+	}
+	outFile = nullptr;
+	if(r) {
+		for(auto &[idx, fi] : stagedFiles)
+			m_files.at(idx) = std::move(fi);
+		for(auto i = decltype(m_files.size()) {0}; i < m_files.size(); ++i) {
+			auto &fi = m_files.at(i);
+			fi.offset = headers.at(i).offset;
+			fi.data = nullptr;
+		}
+		m_sections = sections;
+		m_version = ARCHIVE_VERSION;
+		m_blockCache.Clear();
+		m_dataCache.Clear();
+	}
+	m_in = FileManager::OpenSystemFile(m_systemPath.c_str(), "rb");
+	if(m_in != nullptr)
+		OpenNativeFile();
+	return r;
+}
+
+bool pragma::uva::ArchiveFile::Export(const PayloadProvider &payloadProvider, ExportMode mode)
+{
+	LoadVersionLayer();
+	LoadIndexLayer();
+	if(mode == ExportMode::Append && CanAppend())
+		return ExportAppend(payloadProvider);
 	auto updateFileName = m_updateFile;
 	auto tmpName = updateFileName + std::string("_tmp.dat");
 	auto f = FileManager::OpenFile<VFilePtrReal>(tmpName.c_str(), "wb");
@@ -328,8 +1091,14 @@ bool pragma::uva::ArchiveFile::Export()
 	if(f == nullptr)
 		return false;
 	m_out = f;
+	auto *rawOut = f.get();
 	if(m_fWriteCallback != nullptr && m_fWriteCallback(f) == false)
 		return false;
+	// A second handle to the output, so unchanged payloads can be copied from the archive without passing through user space.
+	// Only valid if the write callback didn't substitute the stream, otherwise the payloads have to go through it as well.
+	std::unique_ptr<NativeFile> outFile = nullptr;
+	if(m_nativeFile != nullptr && f.get() == rawOut)
+		outFile = NativeFile::Open(updateFileName + std::string("_tmp.dat"), NativeFile::Mode::ReadWrite);
 	uint64_t hdVersionOffset = 0;
 	uint64_t hdFileOffset = 0;
 	uint64_t hdFileNameOffset = 0;
@@ -338,21 +1107,31 @@ bool pragma::uva::ArchiveFile::Export()
 	auto startOffset = f->Tell();
 	WriteHeader(hdVersionOffset, hdFileOffset, hdFileNameOffset, hdHierarchyOffset, hdDataOffset);
 
+	SectionOffsets sections {};
+	sections.versions = f->Tell() - startOffset;
 	write_offset(f, startOffset, hdVersionOffset);
 	WriteVersionLayer();
 
+	sections.files = f->Tell() - startOffset;
 	write_offset(f, startOffset, hdFileOffset);
 	uint64_t fileHeaderOffset = 0;
 	WriteFiles(fileHeaderOffset);
 
+	std::vector<FileHeader> headers(m_files.size());
+	sections.fileNames = f->Tell() - startOffset;
 	write_offset(f, startOffset, hdFileNameOffset);
-	WriteFileNames(startOffset, fileHeaderOffset);
+	WriteFileNames(startOffset, headers);
 
+	sections.hierarchy = f->Tell() - startOffset;
 	write_offset(f, startOffset, hdHierarchyOffset);
 	WriteFileHierarchy();
 
+	sections.data = f->Tell() - startOffset;
 	write_offset(f, startOffset, hdDataOffset);
-	WriteFileData(startOffset, fileHeaderOffset);
+	std::vector<std::pair<uint32_t, FileInfo>> stagedFiles;
+	WriteFileData(startOffset, headers, stagedFiles, payloadProvider, false, outFile.get());
+	outFile = nullptr;
+	WriteFileHeaders(fileHeaderOffset, headers);
 	/*auto offset = m_out->Tell();
 	auto old = offset;
 	for(auto &info : m_fileInfo)
@@ -375,7 +1154,26 @@ bool pragma::uva::ArchiveFile::Export()
 		r = FileManager::RenameSystemFile(updateFileName.c_str(), (updateFileName + std::string("_bak.dat")).c_str());
 	if(r == true)
 		r = FileManager::RenameSystemFile((updateFileName + std::string("_tmp.dat")).c_str(), updateFileName.c_str());
+	if(r == true) {
+		// The payloads now live in the new archive, update the in-memory entries to match
+		for(auto &[idx, fi] : stagedFiles)
+			m_files.at(idx) = std::move(fi);
+		for(auto i = decltype(m_files.size()) {0}; i < m_files.size(); ++i) {
+			auto &fi = m_files.at(i);
+			fi.offset = headers.at(i).offset;
+			fi.data = nullptr;
+		}
+		m_inFileStartOffset = startOffset;
+		m_sections = sections;
+		m_version = ARCHIVE_VERSION;
+		m_blockCache.Clear();
+		m_dataCache.Clear();
+		// The archive may not have existed when it was opened, in which case the path wasn't resolved yet
+		m_systemPath = updateFileName;
+	}
 	m_in = FileManager::OpenSystemFile(updateFileName.c_str(), "rb");
+	if(m_in != nullptr)
+		OpenNativeFile();
 	return r;
 }
 pragma::uva::FileInfo *pragma::uva::ArchiveFile::AddFile(const std::string &fname)
@@ -386,38 +1184,42 @@ pragma::uva::FileInfo *pragma::uva::ArchiveFile::AddFile(const std::string &fnam
 
 pragma::uva::FileInfo *pragma::uva::ArchiveFile::AddFile(const std::string &fname, uint32_t &idx)
 {
+	LoadIndexLayer();
 	auto *fi = FindFile(fname, idx);
 	if(fi != nullptr)
 		return fi;
 	idx = 0;
-	auto bIsDir = FileManager::IsDir(fname);
 	auto npath = FileManager::GetCanonicalizedPath(fname);
 	std::vector<std::string> subPaths;
 	ustring::explode(npath, std::string(1, FileManager::GetDirectorySeparator()).c_str(), subPaths);
 	if(subPaths.empty() == true)
 		return nullptr;
 
-	std::function<FileIndexInfo *(FileIndexInfo &, uint32_t)> fAddFile = nullptr;
-	fAddFile = [this, &fAddFile, &subPaths](FileIndexInfo &fii, uint32_t subPathIdx) -> FileIndexInfo * {
-		auto &subPath = subPaths.at(subPathIdx);
-		auto it = std::find_if(fii.children.begin(), fii.children.end(), [this, &subPath](const std::shared_ptr<FileIndexInfo> &fii) { return ustring::compare(subPath, m_files.at(fii->index)->name, false); });
-		if(it == fii.children.end()) {
-			m_files.push_back(std::make_shared<pragma::uva::FileInfo>());
-			auto &fi = m_files.back();
-			fi->name = subPath;
-			if(subPathIdx < subPaths.size() - 1)
-				fi->flags |= pragma::uva::FileInfo::Flags::Directory;
-
-			fii.children.push_back(std::make_shared<FileIndexInfo>());
-			fii.children.back()->parent = fii.shared_from_this();
-			it = fii.children.end() - 1;
-			(*it)->index = m_files.size() - 1;
-		}
-		return (subPathIdx < subPaths.size() - 1) ? fAddFile(*(*it), subPathIdx + 1) : it->get();
-	};
-	auto *fii = fAddFile(*m_root, 0);
-	idx = fii->index;
-	return m_files.at(fii->index).get();
+	// Walk down the existing part of the path through the index and create the remaining entries
+	uint32_t parent = 0;
+	uint64_t hash = FNV_OFFSET_BASIS;
+	for(auto i = decltype(subPaths.size()) {0}; i < subPaths.size(); ++i) {
+		auto &subPath = subPaths.at(i);
+		hash = hash_child_path(hash, parent == 0, subPath);
+		auto child = FindChild(parent, hash, subPath);
+		if(child != INVALID_INDEX) {
+			parent = child;
+			continue;
+		}
+		m_files.push_back({});
+		auto &fi = m_files.back();
+		fi.name = m_names.Add(subPath);
+		if(i < subPaths.size() - 1)
+			fi.flags |= pragma::uva::FileInfo::Flags::Directory;
+
+		child = static_cast<uint32_t>(m_files.size() - 1);
+		m_hierarchy.Resize(m_files.size());
+		m_hierarchy.Link(parent, child);
+		m_pathIndex.emplace(hash, child);
+		parent = child;
+	}
+	idx = parent;
+	return &m_files.at(parent);
 	/*std::function<pragma::uva::FileInfo*(pragma::uva::FileInfo&,std::vector<std::string>&)> fCreatePath = nullptr;
 	fCreatePath = [this,&fCreatePath,&idx,bIsDir](pragma::uva::FileInfo &fi,std::vector<std::string> &subPaths) -> pragma::uva::FileInfo* {
 		if(subPaths.empty() == true)
@@ -450,46 +1252,335 @@ pragma::uva::FileInfo *pragma::uva::ArchiveFile::AddFile(const std::string &fnam
 	return fCreatePath(*m_root,subPaths);*/
 }
 
-bool pragma::uva::ArchiveFile::ExtractAndDecompress(const pragma::uva::FileInfo &fi, std::vector<uint8_t> &data) const
+bool pragma::uva::ArchiveFile::Decompress(const pragma::uva::FileInfo &fi, std::span<uint8_t> buffer, const DataSink &sink) const
 {
-	std::vector<uint8_t> compressedData;
-	ReadFileData(m_inFileStartOffset, fi, compressedData);
-	if(compressedData.empty() == false) {
-		// Decompress data
-		int32_t verbosity = 0;
-		int32_t small = 0;
-		auto szUncompressed = static_cast<uint32_t>(fi.sizeUncompressed);
-		data.resize(szUncompressed);
-
-		auto err = BZ2_bzBuffToBuffDecompress(reinterpret_cast<char *>(data.data()), &szUncompressed, reinterpret_cast<char *>(compressedData.data()), compressedData.size(), small, verbosity);
-		if(err == BZ_OK)
-			return true;
+	if(fi.sizeUncompressed == 0)
+		return true;
+	if(sink == nullptr && buffer.size() < fi.sizeUncompressed)
+		return false;
+	if(fi.IsSolid()) {
+		auto block = GetSolidBlock(fi);
+		if(block == nullptr || fi.blockOffset > block->size() || fi.sizeUncompressed > block->size() - fi.blockOffset)
+			return false;
+		std::span<const uint8_t> data {block->data() + fi.blockOffset, fi.sizeUncompressed};
+		if(sink != nullptr)
+			return sink(data);
+		std::copy(data.begin(), data.end(), buffer.begin());
+		return true;
+	}
+	if(fi.IsChunked()) {
+		auto table = ReadChunkTable(fi);
+		if(table.has_value() == false)
+			return false;
+		uint64_t offset = 0;
+		for(uint32_t i = 0; i < table->chunkEnds.size(); ++i) {
+			auto chunkInfo = GetChunkInfo(fi, *table, i);
+			if(Decompress(chunkInfo, (sink != nullptr) ? buffer : buffer.subspan(offset, chunkInfo.sizeUncompressed), sink) == false)
+				return false;
+			offset += chunkInfo.sizeUncompressed;
+		}
+		return true;
+	}
+	auto codec = fi.GetCodec();
+	if(is_codec_available(codec) == false) {
+		std::cout << "WARNING: Unable to decompress file '" << fi.name << "': Codec '" << codec_to_string(codec) << "' is not available!" << std::endl;
+		return false;
+	}
+	auto mappedData = GetCompressedData(fi);
+	if(sink == nullptr && mappedData.empty() == false)
+		return decompress(codec, mappedData, buffer.subspan(0, fi.sizeUncompressed));
+
+	auto decoder = Decoder::Create(codec, fi.sizeUncompressed);
+	if(decoder == nullptr)
+		return false;
+	// Without a mapping the payload is read in chunks as well, so memory usage stays bounded on both ends
+	std::vector<uint8_t> readBuffer;
+	if(mappedData.empty())
+		readBuffer.resize(std::min<uint64_t>(fi.size, DECOMPRESSION_CHUNK_SIZE));
+	std::span<const uint8_t> in = mappedData;
+	uint64_t readOffset = mappedData.size();
+	std::span<uint8_t> out = buffer;
+	uint64_t numDecompressed = 0;
+	for(;;) {
+		if(in.empty() && readOffset < fi.size) {
+			auto n = std::min<uint64_t>(fi.size - readOffset, readBuffer.size());
+			if(ReadFileData(m_inFileStartOffset, fi, readOffset, std::span<uint8_t> {readBuffer.data(), n}) == false)
+				return false;
+			in = std::span<const uint8_t> {readBuffer.data(), n};
+			readOffset += n;
+		}
+		auto inSize = in.size();
+		auto outSize = out.size();
+		auto result = decoder->Decode(in, out);
+		if(result == Decoder::Result::Error)
+			return false;
+		numDecompressed += outSize - out.size();
+		if(numDecompressed > fi.sizeUncompressed)
+			return false;
+		if(sink != nullptr && (out.empty() || result == Decoder::Result::Finished)) {
+			auto n = buffer.size() - out.size();
+			if(n > 0 && sink(std::span<const uint8_t> {buffer.data(), n}) == false)
+				return false;
+			out = buffer;
+		}
+		if(result == Decoder::Result::Finished)
+			break;
+		if(in.size() == inSize && out.size() == outSize)
+			return false; // Truncated payload or output buffer too small
 	}
-	return false;
+	return numDecompressed == fi.sizeUncompressed;
 }
 
-bool pragma::uva::ArchiveFile::Extract(const pragma::uva::FileInfo &fi, const std::string &outName) const
+bool pragma::uva::ArchiveFile::DecompressPayload(const FileInfo &fi, std::span<const uint8_t> payload, std::span<uint8_t> out) const
 {
-	std::vector<uint8_t> uncompressedData;
-	if(ExtractAndDecompress(fi, uncompressedData) == false)
+	if(fi.IsSolid() || payload.size() != fi.size || out.size() != fi.sizeUncompressed)
 		return false;
-	auto f = FileManager::OpenSystemFile(outName.c_str(), "wb");
-	if(f != nullptr)
-		f->Write(uncompressedData.data(), uncompressedData.size());
+	if(fi.sizeUncompressed == 0)
+		return true;
+	auto codec = fi.GetCodec();
+	if(is_codec_available(codec) == false) {
+		std::cout << "WARNING: Unable to decompress file '" << fi.name << "': Codec '" << codec_to_string(codec) << "' is not available!" << std::endl;
+		return false;
+	}
+	if(fi.IsChunked() == false)
+		return decompress(codec, payload, out);
+	auto table = ParseChunkTable(fi, payload);
+	if(table.has_value() == false)
+		return false;
+	for(uint32_t i = 0; i < table->chunkEnds.size(); ++i) {
+		auto chunkInfo = GetChunkInfo(fi, *table, i);
+		auto start = chunkInfo.offset - fi.offset;
+		if(decompress(codec, payload.subspan(start, chunkInfo.size), out.subspan(static_cast<uint64_t>(i) * table->chunkSize, chunkInfo.sizeUncompressed)) == false)
+			return false;
+	}
 	return true;
 }
 
+std::shared_ptr<const std::vector<uint8_t>> pragma::uva::ArchiveFile::GetSolidBlock(const FileInfo &fi) const
+{
+	if(auto block = m_blockCache.Find(fi.offset))
+		return block;
+	FileInfo blockInfo {};
+	blockInfo.name = fi.name;
+	blockInfo.flags = fi.flags & ~FileInfo::Flags::Solid;
+	blockInfo.offset = fi.offset;
+	blockInfo.size = fi.size;
+	blockInfo.sizeUncompressed = fi.blockSize;
+	auto block = std::make_shared<std::vector<uint8_t>>(fi.blockSize);
+	if(Decompress(blockInfo, *block) == false)
+		return nullptr;
+	m_blockCache.Add(fi.offset, block);
+	return block;
+}
+
+std::optional<pragma::uva::ArchiveFile::ChunkTable> pragma::uva::ArchiveFile::ReadChunkTable(const FileInfo &fi) const
+{
+	ChunkTableHeader header {};
+	if(fi.size < sizeof(header) || ReadFileData(m_inFileStartOffset, fi, 0, std::span<uint8_t> {reinterpret_cast<uint8_t *>(&header), sizeof(header)}) == false)
+		return {};
+	std::vector<uint8_t> data(std::min<uint64_t>(fi.size, sizeof(header) + static_cast<uint64_t>(header.numChunks) * sizeof(uint64_t)));
+	if(ReadFileData(m_inFileStartOffset, fi, 0, data) == false)
+		return {};
+	return ParseChunkTable(fi, data);
+}
+
+std::optional<pragma::uva::ArchiveFile::ChunkTable> pragma::uva::ArchiveFile::ParseChunkTable(const FileInfo &fi, std::span<const uint8_t> data)
+{
+	ChunkTableHeader header {};
+	if(data.size() < sizeof(header))
+		return {};
+	std::memcpy(&header, data.data(), sizeof(header));
+	if(header.chunkSize == 0 || header.numChunks != (fi.sizeUncompressed + header.chunkSize - 1) / header.chunkSize)
+		return {};
+	ChunkTable table {};
+	table.chunkSize = header.chunkSize;
+	table.tableSize = sizeof(header) + static_cast<uint64_t>(header.numChunks) * sizeof(uint64_t);
+	if(data.size() < table.tableSize)
+		return {};
+	table.chunkEnds.resize(header.numChunks);
+	std::memcpy(table.chunkEnds.data(), data.data() + sizeof(header), table.chunkEnds.size() * sizeof(uint64_t));
+	uint64_t prevEnd = 0;
+	for(auto end : table.chunkEnds) {
+		if(end < prevEnd)
+			return {};
+		prevEnd = end;
+	}
+	if(table.tableSize + prevEnd != fi.size)
+		return {};
+	return table;
+}
+
+pragma::uva::FileInfo pragma::uva::ArchiveFile::GetChunkInfo(const FileInfo &fi, const ChunkTable &table, uint32_t chunkIdx) const
+{
+	auto start = (chunkIdx > 0) ? table.chunkEnds.at(chunkIdx - 1) : 0;
+	auto uncompressedStart = static_cast<uint64_t>(chunkIdx) * table.chunkSize;
+	FileInfo chunkInfo {};
+	chunkInfo.name = fi.name;
+	chunkInfo.flags = fi.flags & ~FileInfo::Flags::Chunked;
+	chunkInfo.offset = fi.offset + table.tableSize + start;
+	chunkInfo.size = table.chunkEnds.at(chunkIdx) - start;
+	chunkInfo.sizeUncompressed = std::min<uint64_t>(table.chunkSize, fi.sizeUncompressed - uncompressedStart);
+	return chunkInfo;
+}
+
+bool pragma::uva::ArchiveFile::ReadRange(uint32_t idx, uint64_t offset, std::span<uint8_t> data) const
+{
+	LoadFileLayer();
+	if(idx >= m_files.size())
+		return false;
+	auto &fi = m_files.at(idx);
+	if(fi.IsFile() == false || offset > fi.sizeUncompressed || data.size() > fi.sizeUncompressed - offset)
+		return false;
+	if(data.empty())
+		return true;
+	// Only a part of the file is decompressed, so there's nothing to add to the cache
+	if(auto cached = m_dataCache.Peek(idx)) {
+		std::copy_n(cached->begin() + offset, data.size(), data.begin());
+		return true;
+	}
+	if(fi.IsSolid()) {
+		auto block = GetSolidBlock(fi);
+		if(block == nullptr || fi.blockOffset + offset + data.size() > block->size())
+			return false;
+		std::copy_n(block->begin() + fi.blockOffset + offset, data.size(), data.begin());
+		return true;
+	}
+	if(fi.IsChunked()) {
+		auto table = ReadChunkTable(fi);
+		if(table.has_value() == false)
+			return false;
+		std::vector<uint8_t> chunk;
+		auto end = offset + data.size();
+		for(auto i = static_cast<uint32_t>(offset / table->chunkSize); i < table->chunkEnds.size() && static_cast<uint64_t>(i) * table->chunkSize < end; ++i) {
+			auto chunkInfo = GetChunkInfo(fi, *table, i);
+			auto chunkStart = static_cast<uint64_t>(i) * table->chunkSize;
+			auto copyStart = std::max(offset, chunkStart);
+			auto copyEnd = std::min(end, chunkStart + chunkInfo.sizeUncompressed);
+			auto out = data.subspan(copyStart - offset, copyEnd - copyStart);
+			// Chunks that are covered completely are decompressed in place
+			if(copyStart == chunkStart && copyEnd == chunkStart + chunkInfo.sizeUncompressed) {
+				if(Decompress(chunkInfo, out) == false)
+					return false;
+				continue;
+			}
+			chunk.resize(chunkInfo.sizeUncompressed);
+			if(Decompress(chunkInfo, chunk) == false)
+				return false;
+			std::copy_n(chunk.begin() + (copyStart - chunkStart), out.size(), out.begin());
+		}
+		return true;
+	}
+	if(fi.GetCodec() == Codec::Store && fi.size == fi.sizeUncompressed)
+		return ReadFileData(m_inFileStartOffset, fi, offset, data);
+
+	// Streams through the file and stops once the range is complete
+	std::vector<uint8_t> buffer(std::min<uint64_t>(fi.sizeUncompressed, DECOMPRESSION_CHUNK_SIZE));
+	uint64_t pos = 0;
+	auto end = offset + data.size();
+	auto complete = false;
+	Decompress(fi, buffer, [&](std::span<const uint8_t> chunk) {
+		auto chunkEnd = pos + chunk.size();
+		if(chunkEnd > offset) {
+			auto copyStart = std::max(offset, pos);
+			auto copyEnd = std::min(end, chunkEnd);
+			std::copy_n(chunk.begin() + (copyStart - pos), copyEnd - copyStart, data.begin() + (copyStart - offset));
+		}
+		pos = chunkEnd;
+		complete = (pos >= end);
+		return complete == false;
+	});
+	return complete;
+}
+
+bool pragma::uva::ArchiveFile::ReadRange(const std::string &fname, uint64_t offset, std::span<uint8_t> data) const
+{
+	uint32_t idx = 0;
+	if(FindFile(fname, idx) == nullptr)
+		return false;
+	return ReadRange(idx, offset, data);
+}
+
+bool pragma::uva::ArchiveFile::ExtractAndDecompress(const pragma::uva::FileInfo &fi, std::vector<uint8_t> &data) const
+{
+	data.resize(fi.sizeUncompressed);
+	return Decompress(fi, data);
+}
+
+bool pragma::uva::ArchiveFile::Extract(const pragma::uva::FileInfo &fi, const std::string &outName) const
+{
+	auto f = FileManager::OpenSystemFile(outName.c_str(), "wb");
+	if(f == nullptr)
+		return false;
+	std::vector<uint8_t> buffer(std::min<uint64_t>(fi.sizeUncompressed, DECOMPRESSION_CHUNK_SIZE));
+	return Decompress(fi, buffer, [&f](std::span<const uint8_t> data) { return f->Write(data.data(), data.size()) == data.size(); });
+}
+
+bool pragma::uva::ArchiveFile::ExtractData(const std::string &fname, std::span<uint8_t> data) const
+{
+	uint32_t idx = 0;
+	auto *fi = FindFile(fname, idx);
+	if(fi == nullptr || fi->IsFile() == false)
+		return false;
+	if(m_dataCache.IsEnabled()) {
+		auto cached = GetData(idx);
+		if(cached == nullptr || data.size() < cached->size())
+			return false;
+		std::copy(cached->begin(), cached->end(), data.begin());
+		return true;
+	}
+	return Decompress(*fi, data);
+}
+
+bool pragma::uva::ArchiveFile::ExtractStream(const std::string &fname, const DataSink &sink) const
+{
+	uint32_t idx = 0;
+	auto *fi = FindFile(fname, idx);
+	if(fi == nullptr || fi->IsFile() == false || sink == nullptr)
+		return false;
+	std::vector<uint8_t> buffer(std::min<uint64_t>(fi->sizeUncompressed, DECOMPRESSION_CHUNK_SIZE));
+	return Decompress(*fi, buffer, sink);
+}
+
 bool pragma::uva::ArchiveFile::ExtractData(const std::string &fname, std::vector<uint8_t> &data) const
 {
 	uint32_t idx = 0;
 	auto *fi = FindFile(fname, idx);
 	if(fi == nullptr || fi->IsFile() == false)
 		return false;
+	if(m_dataCache.IsEnabled()) {
+		auto cached = GetData(idx);
+		if(cached == nullptr)
+			return false;
+		data = *cached;
+		return true;
+	}
 	if(ExtractAndDecompress(*fi, data) == false)
 		return false;
 	return true;
 }
 
+std::shared_ptr<const std::vector<uint8_t>> pragma::uva::ArchiveFile::GetData(uint32_t idx) const
+{
+	LoadFileLayer();
+	if(idx >= m_files.size() || m_files.at(idx).IsFile() == false)
+		return nullptr;
+	if(auto cached = m_dataCache.Find(idx))
+		return cached;
+	auto data = std::make_shared<std::vector<uint8_t>>();
+	if(ExtractAndDecompress(m_files.at(idx), *data) == false)
+		return nullptr;
+	m_dataCache.Add(idx, data);
+	return data;
+}
+
+std::shared_ptr<const std::vector<uint8_t>> pragma::uva::ArchiveFile::GetData(const std::string &fname) const
+{
+	uint32_t idx = 0;
+	if(FindFile(fname, idx) == nullptr)
+		return nullptr;
+	return GetData(idx);
+}
+
 bool pragma::uva::ArchiveFile::ExtractFile(const std::string &fname, const std::string &outName) const
 {
 	uint32_t idx = 0;
@@ -508,36 +1599,107 @@ bool pragma::uva::ArchiveFile::ExtractFile(const std::string &fname) const
 	return Extract(*fi, fname);
 }
 
-void pragma::uva::ArchiveFile::ExtractAll(const std::string &path) const
+double pragma::uva::ArchiveFile::ExtractStats::GetThroughput() const
 {
-	if(m_files.empty() == true)
-		return;
-	auto npath = FileManager::GetCanonicalizedPath(path);
+	auto t = std::chrono::duration<double>(duration).count();
+	return (t > 0.0) ? (static_cast<double>(numBytes) / t) : 0.0;
+}
+
+std::vector<std::string> pragma::uva::ArchiveFile::GetRelativePaths() const
+{
+	LoadIndexLayer();
+	std::vector<std::string> paths(m_files.size());
 	auto c = FileManager::GetDirectorySeparator();
-	if(npath.empty() == true || npath.back() != c)
-		npath += c;
-	std::function<void(pragma::uva::ArchiveFile::FileIndexInfo &, const std::string &)> fExtractFiles = nullptr;
-	fExtractFiles = [this, &npath, &fExtractFiles](pragma::uva::ArchiveFile::FileIndexInfo &fii, const std::string &path) {
-		auto &fi = m_files.at(fii.index);
-		auto fpath = path + fi->name;
-		if(fi->IsFile()) {
-			if(Extract(*fi, fpath) == false)
-				std::cout << "WARNING: Unable to extract file '" << fpath << "'!" << std::endl;
+	std::function<void(uint32_t, const std::string &)> fCollectPaths = nullptr;
+	fCollectPaths = [this, c, &paths, &fCollectPaths](uint32_t parent, const std::string &parentPath) {
+		for(auto child = m_hierarchy.firstChildren.at(parent); child != INVALID_INDEX; child = m_hierarchy.nextSiblings.at(child)) {
+			auto &path = paths.at(child);
+			path = parentPath;
+			if(path.empty() == false)
+				path += c;
+			path += m_files.at(child).name;
+			fCollectPaths(child, path);
 		}
-		else {
-			auto lpath = ustring::substr(fpath, path.length());
-			FileManager::CreateSystemPath(path, lpath.c_str());
+	};
+	if(m_files.empty() == false)
+		fCollectPaths(0, "");
+	return paths;
+}
+
+pragma::uva::ArchiveFile::ExtractStats pragma::uva::ArchiveFile::ExtractAll(const std::string &path, uint32_t numThreads) const
+{
+	LoadFileLayer();
+	std::vector<uint32_t> fileIndices;
+	fileIndices.reserve(m_files.size());
+	for(auto i = decltype(m_files.size()) {0}; i < m_files.size(); ++i)
+		fileIndices.push_back(static_cast<uint32_t>(i));
+	return ExtractFiles(path, fileIndices, numThreads);
+}
+
+pragma::uva::ArchiveFile::ExtractStats pragma::uva::ArchiveFile::ExtractFiles(const std::string &path, const std::vector<uint32_t> &fileIndices, uint32_t numThreads) const
+{
+	auto tStart = std::chrono::steady_clock::now();
+	ExtractStats stats {};
+	LoadIndexLayer();
+	auto npath = FileManager::GetCanonicalizedPath(path);
+	auto c = FileManager::GetDirectorySeparator();
+	if(npath.empty() == false && npath.back() == c)
+		npath.pop_back();
+	auto relPaths = GetRelativePaths();
+
+	// Create all directories up front, so the workers only have to write files
+	std::set<std::string> dirs;
+	std::vector<uint32_t> files;
+	files.reserve(fileIndices.size());
+	for(auto idx : fileIndices) {
+		if(idx >= m_files.size() || relPaths.at(idx).empty())
+			continue;
+		auto &fi = m_files.at(idx);
+		auto &relPath = relPaths.at(idx);
+		if(fi.IsDirectory()) {
+			dirs.insert(relPath);
+			continue;
 		}
-		if(fii.children.empty() == false) {
-			if(fpath.empty() == false)
-				fpath += '\\';
-			for(auto &child : fii.children)
-				fExtractFiles(*child, fpath);
+		if(fi.size == 0) // Deleted
+			continue;
+		auto sep = relPath.find_last_of(c);
+		if(sep != std::string::npos)
+			dirs.insert(relPath.substr(0, sep));
+		files.push_back(idx);
+	}
+	for(auto &dir : dirs)
+		FileManager::CreateSystemPath(npath, dir.c_str());
+
+	// Extract in the order the payloads are stored in, so the archive is read sequentially
+	std::sort(files.begin(), files.end(), [this](uint32_t a, uint32_t b) { return m_files.at(a).offset < m_files.at(b).offset; });
+	std::atomic<uint32_t> numFailed = 0;
+	std::atomic<uint64_t> numBytes = 0;
+	auto fExtract = [this, &npath, c, &relPaths, &numFailed, &numBytes](uint32_t idx) {
+		auto &fi = m_files.at(idx);
+		auto fpath = npath.empty() ? relPaths.at(idx) : (npath + c + relPaths.at(idx));
+		if(Extract(fi, fpath) == false) {
+			++numFailed;
+			std::cout << "WARNING: Unable to extract file '" << fpath << "'!" << std::endl;
+			return;
 		}
+		numBytes += fi.sizeUncompressed;
 	};
-	if(npath.length() > 0 && npath.back() == c)
-		npath.pop_back();
-	fExtractFiles(*m_root, npath);
+	numThreads = std::min<uint32_t>(ThreadPool::get_thread_count(numThreads), static_cast<uint32_t>(files.size()));
+	if(numThreads <= 1) {
+		for(auto idx : files)
+			fExtract(idx);
+	}
+	else {
+		ThreadPool pool {numThreads};
+		for(auto idx : files)
+			pool.Submit([&fExtract, idx]() { fExtract(idx); });
+		pool.Wait();
+	}
+	stats.numFiles = static_cast<uint32_t>(files.size());
+	stats.numFailed = numFailed;
+	stats.numBytes = numBytes;
+	stats.duration = std::chrono::steady_clock::now() - tStart;
+	return stats;
 }
 
 pragma::uva::FileInfo *pragma::uva::ArchiveFile::FindFile(const std::string &fname) const
@@ -548,118 +1710,115 @@ pragma::uva::FileInfo *pragma::uva::ArchiveFile::FindFile(const std::string &fna
 
 pragma::uva::FileInfo *pragma::uva::ArchiveFile::FindFile(const std::string &fname, uint32_t &idx) const
 {
-	//if(*fi != P_OS::All && *fi != os)
-	//	return nullptr;
-	auto nname = FileManager::GetCanonicalizedPath(fname);
-	std::vector<std::string> subPaths;
-	ustring::explode(nname, std::string(1, FileManager::GetDirectorySeparator()).c_str(), subPaths);
-
-	std::function<FileIndexInfo *(FileIndexInfo &, uint32_t)> fFindFile = nullptr;
-	fFindFile = [this, &fFindFile, &subPaths](FileIndexInfo &fii, uint32_t subPathIdx) -> FileIndexInfo * {
-		if(subPathIdx >= subPaths.size())
-			return nullptr;
-		auto &subPath = subPaths.at(subPathIdx);
-		auto it = std::find_if(fii.children.begin(), fii.children.end(), [this, &subPath](const std::shared_ptr<FileIndexInfo> &fii) {
-			auto &fi = m_files.at(fii->index);
-			return ustring::compare(subPath, fi->name, false);
-		});
-		if(it == fii.children.end())
-			return nullptr;
-		return (subPathIdx == subPaths.size() - 1) ? it->get() : fFindFile(*(*it), subPathIdx + 1);
-	};
-	auto *fii = fFindFile(*m_root, 0);
+	auto fileIdx = LookupPath(fname);
 	idx = 0;
-	if(fii == nullptr)
+	if(fileIdx == INVALID_INDEX)
 		return nullptr;
-	idx = fii->index;
-	return m_files.at(fii->index).get();
+	idx = fileIdx;
+	return &m_files.at(fileIdx);
 }
 
 void pragma::uva::ArchiveFile::SearchFiles(const std::string &searchPattern, std::vector<pragma::uva::FileInfo *> &results) const
 {
+	LoadIndexLayer();
 	auto nname = FileManager::GetCanonicalizedPath(searchPattern);
 	std::vector<std::string> subPaths;
 	ustring::explode(nname, std::string(1, FileManager::GetDirectorySeparator()).c_str(), subPaths);
 
-	std::function<void(FileIndexInfo &, uint32_t)> fFindFiles = nullptr;
-	fFindFiles = [this, &fFindFiles, &subPaths, &results](FileIndexInfo &fii, uint32_t subPathIdx) {
+	std::function<void(const FileIndexInfo &, uint32_t)> fFindFiles = nullptr;
+	fFindFiles = [this, &fFindFiles, &subPaths, &results](const FileIndexInfo &fii, uint32_t subPathIdx) {
 		if(subPathIdx >= subPaths.size())
 			return;
 		auto &subPath = subPaths.at(subPathIdx);
 		auto bLastIteration = (subPathIdx == subPaths.size() - 1) ? true : false;
-		for(auto &child : fii.children) {
-			auto &fi = m_files.at(child->index);
-			if(ustring::match(fi->name, subPath) == true) {
+		for(auto child : fii.GetChildren()) {
+			auto &fi = m_files.at(child.index);
+			if(ustring::match(std::string {fi.name}, subPath) == true) {
 				if(bLastIteration == true)
-					results.push_back(fi.get());
+					results.push_back(&fi);
 				else
-					fFindFiles(*child, subPathIdx + 1);
+					fFindFiles(child, subPathIdx + 1);
 			}
 		}
 	};
-	fFindFiles(*m_root, 0);
+	fFindFiles(GetRoot(), 0);
 }
 
-const std::vector<std::shared_ptr<pragma::uva::FileInfo>> &pragma::uva::ArchiveFile::GetFiles() const { return m_files; }
-std::shared_ptr<pragma::uva::FileInfo> pragma::uva::ArchiveFile::GetByIndex(uint32_t idx)
+const std::vector<pragma::uva::FileInfo> &pragma::uva::ArchiveFile::GetFiles() const
 {
+	LoadFileLayer();
+	return m_files;
+}
+pragma::uva::FileInfo *pragma::uva::ArchiveFile::GetByIndex(uint32_t idx)
+{
+	LoadFileLayer();
 	if(idx >= m_files.size())
 		return nullptr;
-	return m_files.at(idx);
+	return &m_files.at(idx);
 }
-pragma::uva::ArchiveFile::FileIndexInfo *pragma::uva::ArchiveFile::FindFileIndexInfo(FileInfo &fi) const
+std::optional<pragma::uva::ArchiveFile::FileIndexInfo> pragma::uva::ArchiveFile::FindFileIndexInfo(const FileInfo &fi) const
 {
-	auto it = std::find_if(m_files.begin(), m_files.end(), [&fi](const std::shared_ptr<FileInfo> &fiOther) { return (&fi == fiOther.get()) ? true : false; });
-	if(it == m_files.end())
-		return nullptr;
-	auto idx = it - m_files.begin();
-	std::function<FileIndexInfo *(FileIndexInfo &)> fFindIndexInfo = nullptr;
-	fFindIndexInfo = [&fFindIndexInfo, idx](FileIndexInfo &fii) -> FileIndexInfo * {
-		if(fii.index == idx)
-			return &fii;
-		for(auto &child : fii.children) {
-			auto *fii = fFindIndexInfo(*child);
-			if(fii != nullptr)
-				return fii;
-		}
-		return nullptr;
-	};
-	return fFindIndexInfo(*m_root);
+	LoadIndexLayer();
+	if(m_files.empty() || &fi < m_files.data() || &fi >= m_files.data() + m_files.size())
+		return {};
+	return FileIndexInfo {*this, static_cast<uint32_t>(&fi - m_files.data())};
 }
-std::string pragma::uva::ArchiveFile::GetFullPath(FileIndexInfo *fii) const
+std::string pragma::uva::ArchiveFile::GetFullPath(const FileIndexInfo &fii) const
 {
-	auto *fi = m_files.at(fii->index).get();
-	auto path = fi->name;
-	while(fii->parent.expired() == false) {
-		auto parent = fii->parent.lock();
-		path = m_files.at(parent->index)->name + '\\' + path;
-		fii = parent.get();
+	std::string path {m_files.at(fii.index).name};
+	for(auto cur = fii; cur.HasParent();) {
+		cur = cur.GetParent();
+		path = std::string {m_files.at(cur.index).name} + '\\' + path;
 	}
 	return path;
 }
 
 void pragma::uva::ArchiveFile::AddVersion(VersionInfo &newVersion)
 {
-	// Remove files of new update from older version infos
-	auto &versions = GetVersions();
-	for(uint32_t i = static_cast<uint32_t>(versions.size()) - 1; i != (uint32_t)-1; i--) {
-		VersionInfo &info = versions[i];
-		for(uint32_t j = static_cast<uint32_t>(info.files.size()) - 1; j != (uint32_t)-1; j--) {
-			for(uint32_t k = 0; k < newVersion.files.size(); k++) {
-				if(info.files[j] == newVersion.files[k]) {
-					info.files.erase(info.files.begin() + j);
-					break;
-				}
-			}
+	LoadVersionLayer();
+	std::unordered_set<uint32_t> newFiles;
+	newFiles.reserve(newVersion.files.size());
+	std::erase_if(newVersion.files, [&newFiles](uint32_t idx) { return newFiles.insert(idx).second == false; });
+
+	// Files of the new update are removed from the older version infos lazily, the index decides which entries are current
+	std::vector<util::Version> supersededVersions;
+	for(auto idx : newVersion.files) {
+		if(idx >= m_fileVersions.size())
+			m_fileVersions.resize(idx + 1);
+		auto &fileVersion = m_fileVersions.at(idx);
+		if(fileVersion.has_value()) {
+			--m_versionLiveCounts[*fileVersion];
+			supersededVersions.push_back(*fileVersion);
 		}
-		if(info.files.empty())
-			versions.erase(versions.begin() + i);
+		fileVersion = newVersion.version;
 	}
-	versions.push_front(newVersion);
+	m_versionLiveCounts[newVersion.version] = static_cast<uint32_t>(newVersion.files.size());
+	std::sort(supersededVersions.begin(), supersededVersions.end());
+	supersededVersions.erase(std::unique(supersededVersions.begin(), supersededVersions.end()), supersededVersions.end());
+	// Versions are only visited once and the empty ones removed together, erasing them one at a time would be
+	// quadratic in the number of versions
+	if(supersededVersions.empty() == false) {
+		auto fIsSuperseded = [&supersededVersions](const VersionInfo &info) { return std::binary_search(supersededVersions.begin(), supersededVersions.end(), info.version); };
+		for(auto &info : m_versions) {
+			if(fIsSuperseded(info) == false)
+				continue;
+			auto liveCount = m_versionLiveCounts[info.version];
+			if(liveCount > 0 && liveCount < info.files.size() / 2)
+				PruneVersion(info);
+		}
+		std::erase_if(m_versions, [this, &fIsSuperseded](const VersionInfo &info) { return fIsSuperseded(info) && m_versionLiveCounts[info.version] == 0; });
+		for(auto &version : supersededVersions) {
+			auto it = m_versionLiveCounts.find(version);
+			if(it != m_versionLiveCounts.end() && it->second == 0)
+				m_versionLiveCounts.erase(it);
+		}
+	}
+	m_versions.push_front(newVersion);
 }
 
 void pragma::uva::ArchiveFile::Close()
 {
+	m_nativeFile = nullptr;
 	if(m_in != nullptr)
 		m_in = nullptr;
 	if(m_out != nullptr)
@@ -668,6 +1827,7 @@ void pragma::uva::ArchiveFile::Close()
 
 bool pragma::uva::ArchiveFile::GetLatestVersion(util::Version *version)
 {
+	LoadVersionLayer();
 	if(m_versions.empty())
 		return false;
 	auto &info = m_versions.front();
@@ -675,5 +1835,13 @@ bool pragma::uva::ArchiveFile::GetLatestVersion(util::Version *version)
 	return true;
 }
 
-pragma::uva::ArchiveFile::FileIndexInfo &pragma::uva::ArchiveFile::GetRoot() { return *m_root; }
-std::deque<pragma::uva::VersionInfo> &pragma::uva::ArchiveFile::GetVersions() { return m_versions; }
+pragma::uva::ArchiveFile::FileIndexInfo pragma::uva::ArchiveFile::GetRoot() const
+{
+	LoadIndexLayer();
+	return FileIndexInfo {*this, 0};
+}
+std::deque<pragma::uva::VersionInfo> &pragma::uva::ArchiveFile::GetVersions()
+{
+	PruneVersions();
+	return m_versions;
+}
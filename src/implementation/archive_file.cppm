@@ -4,40 +4,240 @@
 module;
 
 #include "definitions.hpp"
+#include "util_enum_flags.hpp"
 
 export module pragma.uva:archive_file;
 
+import :codec;
 import :version_info;
 import :fileinfo;
+import :native_file;
+import :thread_pool;
 export import pragma.filesystem;
 
 export namespace pragma::uva {
+	// Thread-safety: Once an archive has been opened, the const lookup and extraction functions (FindFile, SearchFiles,
+	// ExtractData, ExtractFile, GetCompressedData, etc.) may be called concurrently from any number of threads.
+	// Payloads are read with positional reads or from the memory mapping, so no file pointer is shared between threads;
+	// if the read callback substitutes the stream, reads on it are serialized internally instead.
+	// Functions that modify the archive (AddFile, AddVersion, Export, ...) require exclusive access.
+	enum class ExportMode : uint8_t {
+		// Writes a new archive that only contains the live payloads and replaces the old one with it
+		Rewrite = 0,
+		// Appends the new payloads and metadata to the existing archive and repoints the header to them, so the cost
+		// only depends on the size of the change. Superseded payloads remain in the archive as dead space until it is
+		// compacted (see ArchiveFile::Compact). Falls back to Rewrite if the archive can't be appended to, e.g. because
+		// it doesn't exist yet, the read callback substituted the stream or a write callback is set.
+		Append,
+	};
+
+	struct PublishOptions {
+		// Number of compression threads, 0 = one per hardware thread
+		uint32_t numThreads = 0;
+		// Upper bound for file data that has been read but not yet written to the archive. A single file that
+		// is larger than this is still processed, but nothing else is read until it has been written.
+		uint64_t maxBufferedBytes = 256 * 1024 * 1024;
+		// Codec for files that don't specify one (see PublishInfo::codec)
+		Codec codec = Codec::Bzip2;
+		// Files that don't compress below this fraction of their size (e.g. files that are already compressed) are stored uncompressed
+		double storeThreshold = 0.95;
+		ExportMode exportMode = ExportMode::Append;
+		// Files of up to solidFileSizeLimit bytes are packed into shared blocks of up to solidBlockSize bytes (uncompressed)
+		// per directory, which are compressed as a whole. Avoids the per-stream overhead for archives with many small files.
+		// Only applies to files that don't specify a codec. 0 disables solid blocks.
+		uint64_t solidBlockSize = 0;
+		uint64_t solidFileSizeLimit = 64 * 1024;
+		// Files larger than this are split into chunks of this size (uncompressed) that are compressed independently, so
+		// ranges of the file can be read without decompressing all of it (see ArchiveFile::ReadRange). 0 disables chunking.
+		uint32_t chunkSize = 0;
+		// Files whose size, modification time and inode match the ones recorded by the previous publish are assumed to be
+		// unchanged and aren't read at all, otherwise their content is compared. The archive name has to be known without
+		// reading the file, so dataTranslateCallback mustn't rename files depending on their content.
+		bool skipUnchangedByStat = true;
+	};
+
+	struct CompactOptions {
+		// Removes the entries of deleted files (and of directories that end up empty) from the index. Clients that
+		// are older than the deletion won't be told to remove these files anymore.
+		bool removeDeletedEntries = true;
+	};
+
+	struct PatchOptions {
+		// Codec for the deltas and for files that are stored in full
+		Codec codec = Codec::Bzip2;
+		// Files whose compressed delta isn't smaller than this fraction of the compressed file are stored in full
+		double maxDeltaRatio = 0.75;
+	};
+
+	struct BatchExtractOptions {
+		// Worker threads of the batch, 0 = one per hardware thread
+		uint32_t numThreads = 0;
+		// Payloads that are at most this many bytes apart are fetched with a single read, including the gap
+		uint64_t maxReadGap = 64 * 1024;
+		// Upper bound for a coalesced read. Payloads that are larger than this are streamed on their own.
+		uint64_t maxReadSize = 4 * 1024 * 1024;
+	};
+
 	class DLLUVA ArchiveFile {
 	  public:
-		struct FileIndexInfo : public std::enable_shared_from_this<FileIndexInfo> {
+		static constexpr uint32_t INVALID_INDEX = std::numeric_limits<uint32_t>::max();
+		// Lightweight view of an entry in the archive hierarchy, only valid for as long as the archive exists.
+		// The root has index 0.
+		class DLLUVA FileIndexInfo {
+		  public:
+			class DLLUVA ChildIterator {
+			  public:
+				using iterator_category = std::forward_iterator_tag;
+				using value_type = FileIndexInfo;
+				using difference_type = std::ptrdiff_t;
+				ChildIterator(const ArchiveFile &archive, uint32_t index);
+				FileIndexInfo operator*() const;
+				ChildIterator &operator++();
+				bool operator==(const ChildIterator &other) const;
+			  private:
+				const ArchiveFile *m_archive = nullptr;
+				uint32_t m_index = INVALID_INDEX;
+			};
+			struct ChildRange {
+				ChildIterator first;
+				ChildIterator last;
+				ChildIterator begin() const { return first; }
+				ChildIterator end() const { return last; }
+			};
+			FileIndexInfo(const ArchiveFile &archive, uint32_t index);
 			uint32_t index = 0;
-			std::vector<std::shared_ptr<FileIndexInfo>> children;
-			std::weak_ptr<FileIndexInfo> parent;
+			bool HasParent() const;
+			// Must not be called on the root
+			FileIndexInfo GetParent() const;
+			ChildRange GetChildren() const;
+		  private:
+			const ArchiveFile *m_archive = nullptr;
 		};
 		enum class UpdateResult : uint32_t { Success = 0, ListFileNotFound, NothingToUpdate, UnableToCreateArchiveFile, VersionDiscrepancy, UnableToRemoveTemporaryFiles };
+		enum class OpenFlags : uint32_t {
+			None = 0u,
+			// Maps the archive into memory, so that compressed payloads can be accessed without any file reads or copies.
+			// Only applies if the read callback does not replace the file handle, otherwise the regular read path is used.
+			MemoryMapped = 1u,
+		};
 		~ArchiveFile();
-		static ArchiveFile *Open(const std::string &updateFileName, const std::function<bool(VFilePtr &)> &readCallback = nullptr, const std::function<bool(VFilePtrReal &)> &writeCallback = nullptr);
+		static ArchiveFile *Open(const std::string &updateFileName, const std::function<bool(VFilePtr &)> &readCallback = nullptr, const std::function<bool(VFilePtrReal &)> &writeCallback = nullptr, OpenFlags flags = OpenFlags::None);
 		bool GetLatestVersion(util::Version *version);
-		FileIndexInfo &GetRoot();
+		FileIndexInfo GetRoot() const;
+		// Newest first. Every file is listed by the latest version that changed it only. The file lists must not be
+		// modified directly, use AddVersion instead.
 		std::deque<VersionInfo> &GetVersions();
+		// Removes the files of the new version from the older versions, dropping versions that end up empty. The cost
+		// is linear in the size of the new version (amortized), regardless of the number and size of the older versions.
 		void AddVersion(VersionInfo &newVersion);
-		bool Export();
+		// Latest version that changed the file, nullopt if the file isn't part of any version
+		std::optional<util::Version> GetFileVersion(uint32_t idx) const;
+		bool Export(ExportMode mode = ExportMode::Rewrite);
+		struct SpaceStats {
+			// Size of the archive on disk, excluding anything before the archive start offset
+			uint64_t archiveSize = 0;
+			// Payloads of files that haven't been deleted
+			uint64_t liveBytes = 0;
+			// Header and current metadata sections
+			uint64_t metadataBytes = 0;
+			// Superseded payloads and metadata, i.e. what compaction would reclaim
+			uint64_t deadBytes = 0;
+			uint32_t numEntries = 0;
+			// Deleted files and directories without any remaining files
+			uint32_t numDeadEntries = 0;
+			double GetDeadRatio() const;
+		};
+		SpaceStats GetSpaceStats() const;
+		// Rewrites the archive with only the live payloads, dropping superseded payloads and metadata blocks. The
+		// entries are renumbered in depth-first order and the payloads stored in that order, so files of the same
+		// directory are adjacent. Version file lists are remapped accordingly, versions left without files are dropped
+		// (except for the latest).
+		bool Compact(const CompactOptions &options = {});
 		VFilePtr &GetFile();
+		// Appends the files that changed after 'version', without duplicates and in the order their payloads are stored in
 		void GetUpdateFiles(const util::Version &version, std::vector<uint32_t> &updateFiles) const;
+		// Writes a patch archive that updates 'base' to the latest version of this archive. It contains the versions
+		// that are newer than the latest version of 'base' and the files that changed in them, either as a delta
+		// against the file in 'base' or, for new files and files where the delta doesn't pay off, in full. The latest
+		// version of 'base' is recorded in the patch as well.
+		bool CreatePatch(ArchiveFile &base, const std::string &patchFileName, const PatchOptions &options = {});
+		// Applies a patch archive created by CreatePatch to this archive and exports it. Fails without modifying the
+		// archive unless its latest version is the one the patch was created against, or if any of the files doesn't match
+		// the patch base.
+		bool ApplyPatch(const std::string &patchFileName, ExportMode mode = ExportMode::Rewrite);
 
-		void ExtractAll(const std::string &outPath) const;
+		struct ExtractStats {
+			uint32_t numFiles = 0;
+			uint32_t numFailed = 0;
+			// Uncompressed bytes written to disk
+			uint64_t numBytes = 0;
+			std::chrono::steady_clock::duration duration {};
+			// In bytes per second
+			double GetThroughput() const;
+		};
+		// Extracts all files into the specified directory. Decompression and writing are spread across numThreads threads
+		// (0 = one per hardware thread), directories are created beforehand.
+		ExtractStats ExtractAll(const std::string &outPath, uint32_t numThreads = 0) const;
+		// Same as ExtractAll, but only extracts the specified files (e.g. the result of GetUpdateFiles)
+		ExtractStats ExtractFiles(const std::string &outPath, const std::vector<uint32_t> &fileIndices, uint32_t numThreads = 0) const;
 		bool ExtractFile(const std::string &fname, const std::string &outName) const;
 		bool ExtractFile(const std::string &fname) const;
 		bool ExtractData(const std::string &fname, std::vector<uint8_t> &data) const;
-		const std::vector<std::shared_ptr<FileInfo>> &GetFiles() const;
-		std::shared_ptr<FileInfo> GetByIndex(uint32_t idx);
-		FileIndexInfo *FindFileIndexInfo(FileInfo &fi) const;
-		std::string GetFullPath(FileIndexInfo *fii) const;
+		// Decompresses into a caller-provided buffer, which has to hold at least FileInfo::sizeUncompressed bytes
+		bool ExtractData(const std::string &fname, std::span<uint8_t> data) const;
+		// Receives the decompressed data in consecutive chunks, returning false aborts the extraction
+		using DataSink = std::function<bool(std::span<const uint8_t>)>;
+		// Decompresses the file chunk by chunk into the sink; memory usage is bounded regardless of the file size
+		bool ExtractStream(const std::string &fname, const DataSink &sink) const;
+		// Reads data.size() bytes of the uncompressed file, starting at 'offset'. Only the chunks that overlap the range
+		// are decompressed for chunked files, uncompressed files are read directly; other files are decompressed up to
+		// the end of the range.
+		bool ReadRange(uint32_t idx, uint64_t offset, std::span<uint8_t> data) const;
+		bool ReadRange(const std::string &fname, uint64_t offset, std::span<uint8_t> data) const;
+		bool IsMemoryMapped() const;
+		// View of the compressed payload of the file inside the memory-mapped archive. For files in a solid block this is
+		// the entire block. Empty if the archive is not memory-mapped or the file has no data.
+		std::span<const uint8_t> GetCompressedData(const FileInfo &fi) const;
+		struct CacheStats {
+			uint64_t hits = 0;
+			uint64_t misses = 0;
+			uint64_t evictions = 0;
+			// Bytes currently cached
+			uint64_t size = 0;
+			uint64_t capacity = 0;
+		};
+		// Upper bound for the decompressed solid blocks that are kept around, so that reading sibling files doesn't
+		// decompress their block again. 0 disables the cache.
+		void SetBlockCacheSize(uint64_t size);
+		CacheStats GetBlockCacheStats() const;
+		// Opt-in cache of decompressed file data, bounded to 'size' bytes, least recently used files are evicted first.
+		// Used by GetData and ExtractData. ReadRange and OpenFile use cached data as well, but don't add to the cache.
+		// Disabled (0) by default.
+		void SetDataCacheSize(uint64_t size);
+		CacheStats GetDataCacheStats() const;
+		// Decompressed data of the file, served from the data cache if it is enabled and the file has been read before.
+		// The data is shared with the cache and other callers. Returns nullptr if the file doesn't exist or can't be read.
+		std::shared_ptr<const std::vector<uint8_t>> GetData(uint32_t idx) const;
+		std::shared_ptr<const std::vector<uint8_t>> GetData(const std::string &fname) const;
+		// Receives the position of the file in the request list and its decompressed data, which is nullptr if the file
+		// doesn't exist or couldn't be read. Called from the worker threads of the batch, but never concurrently.
+		using BatchCallback = std::function<void(size_t, const std::shared_ptr<const std::vector<uint8_t>> &)>;
+		class ExtractBatch;
+		// Decompresses the files in the background and hands them to the callback as they complete. The reads are sorted
+		// by their position in the archive and adjacent payloads are coalesced into large sequential reads. Uses the data
+		// cache if it is enabled. The batch must not outlive the archive.
+		std::unique_ptr<ExtractBatch> ExtractDataAsync(const std::vector<uint32_t> &fileIndices, const BatchCallback &callback, const BatchExtractOptions &options = {}) const;
+		std::unique_ptr<ExtractBatch> ExtractDataAsync(const std::vector<std::string> &fileNames, const BatchCallback &callback, const BatchExtractOptions &options = {}) const;
+		// Read-only handle that decompresses the file on demand (see FileStream)
+		class FileStream;
+		// Returns nullptr if there is no such file. The stream refers to the archive and is invalidated by modifying it.
+		std::unique_ptr<FileStream> OpenFile(uint32_t idx) const;
+		std::unique_ptr<FileStream> OpenFile(const std::string &fname) const;
+		// The entries are stored contiguously, so adding files invalidates previously returned FileInfo pointers
+		const std::vector<FileInfo> &GetFiles() const;
+		FileInfo *GetByIndex(uint32_t idx);
+		std::optional<FileIndexInfo> FindFileIndexInfo(const FileInfo &fi) const;
+		std::string GetFullPath(const FileIndexInfo &fii) const;
 		FileInfo *AddFile(const std::string &fname, uint32_t &idx);
 		FileInfo *AddFile(const std::string &fname);
 		FileInfo *FindFile(const std::string &fname) const;
@@ -45,8 +245,14 @@ export namespace pragma::uva {
 
 		void SearchFiles(const std::string &searchPattern, std::vector<FileInfo *> &results) const;
 
+		// The files are read and translated on a dedicated reader thread, in archive index order, while they are compressed on a thread pool.
+		// dataTranslateCallback is therefore never called from the calling thread, but also never concurrently.
 		static UpdateResult PublishUpdate(util::Version &version, const std::string &updateListFile, const std::string &archiveFile, const std::function<bool(VFilePtr &)> &readCallback = nullptr, const std::function<bool(VFilePtrReal &)> &writeCallback = nullptr,
-		  const std::function<void(std::string &, std::string &, std::vector<uint8_t> &)> &dataTranslateCallback = nullptr);
+		  const std::function<void(std::string &, std::string &, std::vector<uint8_t> &)> &dataTranslateCallback = nullptr, const PublishOptions &options = {});
+		// Same as above for a list of files that has already been resolved, e.g. by walking the source directories. The list
+		// is normalized and deduplicated in place.
+		static UpdateResult PublishUpdate(const std::string &filePath, util::Version &version, std::vector<PublishInfo> &files, const std::string &updateFile, const std::function<bool(VFilePtr &)> &readCallback = nullptr, const std::function<bool(VFilePtrReal &)> &writeCallback = nullptr,
+		  const std::function<void(std::string &, std::string &, std::vector<uint8_t> &)> &dataTranslateCallback = nullptr, const PublishOptions &options = {});
 
 		static std::string result_code_to_string(UpdateResult code);
 	  protected:
@@ -58,17 +264,106 @@ export namespace pragma::uva {
 			uint64_t sizeUncompressed = 0;
 			uint64_t offset = 0;
 			uint32_t crc = 0;
+			// Since version 4
+			uint64_t contentHash = 0;
+			// Since version 5
+			uint64_t blockOffset = 0;
+			uint64_t blockSize = 0;
+			// Since version 7
+			uint64_t sourceSize = 0;
+			int64_t sourceMtime = 0;
+			uint64_t sourceInode = 0;
 		};
 #pragma pack(pop)
-		ArchiveFile(const std::string &updateFileName, VFilePtrReal &f, const std::function<bool(VFilePtr &)> &readCallback = nullptr, const std::function<bool(VFilePtrReal &)> &writeCallback = nullptr);
+		// Parent, first-child and next-sibling links of all entries, indexed by file index
+		struct Hierarchy {
+			std::vector<uint32_t> parents;
+			std::vector<uint32_t> firstChildren;
+			std::vector<uint32_t> lastChildren;
+			std::vector<uint32_t> nextSiblings;
+			// New entries are unlinked
+			void Resize(size_t size);
+			// Appends 'child' to the children of 'parent'
+			void Link(uint32_t parent, uint32_t child);
+		};
+		// Append-only storage for the file names. Blocks are never reallocated, so the views handed out stay valid.
+		class NamePool {
+		  public:
+			std::string_view Add(std::string_view name);
+			// Makes sure the next 'size' bytes of names end up in a single block
+			void Reserve(size_t size);
+			// Takes ownership of a block whose contents are referenced directly, e.g. the name section of the archive
+			void AddBlock(std::unique_ptr<char[]> block, size_t size);
+		  private:
+			std::vector<std::unique_ptr<char[]>> m_blocks;
+			size_t m_blockSize = 0;
+			size_t m_blockUsed = 0;
+		};
+		ArchiveFile(const std::string &updateFileName, const std::string &systemPath, VFilePtrReal &f, const std::function<bool(VFilePtr &)> &readCallback = nullptr, const std::function<bool(VFilePtrReal &)> &writeCallback = nullptr,
+		  OpenFlags flags = OpenFlags::None);
 		VFilePtr m_in;
 		VFilePtrReal m_out;
 		std::string m_updateFile;
-		std::deque<VersionInfo> m_versions;
-		std::vector<std::shared_ptr<FileInfo>> m_files;
-		std::unordered_map<uint32_t, std::vector<uint32_t>> m_hierarchy;
-		std::shared_ptr<FileIndexInfo> m_root = nullptr;
+		std::string m_systemPath;
+		OpenFlags m_openFlags = OpenFlags::None;
+		// Direct handle to the archive on disk, used for concurrent reads and memory-mapping
+		std::unique_ptr<NativeFile> m_nativeFile = nullptr;
+		// Guards m_in for reads when no native file handle is available
+		mutable std::mutex m_readMutex;
+		// Size-bounded LRU cache of decompressed data, safe to use from multiple threads
+		class DataCache {
+		  public:
+			DataCache(uint64_t capacity);
+			std::shared_ptr<const std::vector<uint8_t>> Find(uint64_t key);
+			// Like Find, but neither counts towards the stats nor changes the eviction order. For readers that don't
+			// add what they read to the cache.
+			std::shared_ptr<const std::vector<uint8_t>> Peek(uint64_t key) const;
+			void Add(uint64_t key, const std::shared_ptr<const std::vector<uint8_t>> &data);
+			bool IsEnabled() const;
+			void SetCapacity(uint64_t capacity);
+			CacheStats GetStats() const;
+			void Clear();
+		  private:
+			void Evict();
+			mutable std::mutex m_mutex;
+			std::list<std::pair<uint64_t, std::shared_ptr<const std::vector<uint8_t>>>> m_entries;
+			std::unordered_map<uint64_t, decltype(m_entries)::iterator> m_entryIndex;
+			std::atomic<uint64_t> m_capacity = 0;
+			CacheStats m_stats {};
+		};
+		// Solid blocks by block offset
+		static constexpr uint64_t DEFAULT_BLOCK_CACHE_SIZE = 16 * 1024 * 1024;
+		mutable DataCache m_blockCache {DEFAULT_BLOCK_CACHE_SIZE};
+		// Files by index
+		mutable DataCache m_dataCache {0};
+		// Offsets of the archive sections relative to m_inFileStartOffset, only set if a valid archive was opened
+		struct SectionOffsets {
+			uint64_t versions = 0;
+			uint64_t files = 0;
+			uint64_t fileNames = 0;
+			uint64_t hierarchy = 0;
+			uint64_t data = 0;
+		};
+		std::optional<SectionOffsets> m_sections {};
+		// The metadata is read in layers on first use (see LoadVersionLayer, LoadFileLayer and LoadIndexLayer),
+		// e.g. a version check never has to parse the file table.
+		mutable std::once_flag m_versionLayerLoaded;
+		mutable std::once_flag m_fileLayerLoaded;
+		mutable std::once_flag m_indexLayerLoaded;
+		mutable std::deque<VersionInfo> m_versions;
+		// File index -> latest version that lists the file (see GetFileVersion). Superseded entries are only removed from
+		// the file lists of older versions once they make up half of the list, or before the lists are handed out
+		// (see PruneVersions); m_versionLiveCounts holds the number of entries per version that are still current.
+		mutable std::vector<std::optional<util::Version>> m_fileVersions;
+		mutable std::map<util::Version, uint32_t> m_versionLiveCounts;
+		mutable std::vector<FileInfo> m_files;
+		mutable Hierarchy m_hierarchy;
+		mutable NamePool m_names;
+		// Hash of the normalized full path (see hash_path) -> file index, for all entries except the root.
+		// Candidates are verified with MatchesPath.
+		mutable std::unordered_multimap<uint64_t, uint32_t> m_pathIndex;
 		uint64_t m_inFileStartOffset = 0;
+		uint32_t m_version = 0;
 		//std::shared_ptr<FileInfo> m_root = nullptr;
 		//std::vector<std::weak_ptr<FileInfo>> m_indexedFiles;
 		//uint32_t m_nextIndex = 1;
@@ -76,23 +371,150 @@ export namespace pragma::uva {
 		std::function<bool(VFilePtrReal &)> m_fWriteCallback = nullptr;
 		bool Extract(const FileInfo &fi, const std::string &outName) const;
 		bool ExtractAndDecompress(const FileInfo &fi, std::vector<uint8_t> &data) const;
+		// Decompresses directly into 'buffer' if no sink is specified, otherwise 'buffer' is used as the staging
+		// area for the chunks passed to the sink
+		bool Decompress(const FileInfo &fi, std::span<uint8_t> buffer, const DataSink &sink = nullptr) const;
+		// Decompresses a payload that has already been read, 'out' has to hold exactly FileInfo::sizeUncompressed bytes.
+		// Not applicable to solid files.
+		bool DecompressPayload(const FileInfo &fi, std::span<const uint8_t> payload, std::span<uint8_t> out) const;
+		// Decompressed solid block that contains the file, nullptr on failure
+		std::shared_ptr<const std::vector<uint8_t>> GetSolidBlock(const FileInfo &fi) const;
+		struct ChunkTable {
+			uint32_t chunkSize = 0;
+			// Relative to the end of the table
+			std::vector<uint64_t> chunkEnds;
+			uint64_t tableSize = 0;
+		};
+		std::optional<ChunkTable> ReadChunkTable(const FileInfo &fi) const;
+		// 'data' has to start with the payload of the file and contain at least the entire table
+		static std::optional<ChunkTable> ParseChunkTable(const FileInfo &fi, std::span<const uint8_t> data);
+		// Describes chunk 'chunkIdx' of a chunked file as a file of its own
+		FileInfo GetChunkInfo(const FileInfo &fi, const ChunkTable &table, uint32_t chunkIdx) const;
 		//FileInfo *FindFile(FileInfo *fi,const std::string &fname,P_OS os,uint32_t &idx,uint64_t fnameOffset=0) const;
-		static UpdateResult PublishUpdate(const std::string &filePath, util::Version &version, std::vector<PublishInfo> &files, const std::string &updateFile, const std::function<bool(VFilePtr &)> &readCallback = nullptr, const std::function<bool(VFilePtrReal &)> &writeCallback = nullptr,
-		  const std::function<void(std::string &, std::string &, std::vector<uint8_t> &)> &dataTranslateCallback = nullptr);
+		// Called by Export for every file in ascending index order. Returns true if it supplied the new compressed payload
+		// for the file (and updated its size, crc, etc.); an empty payload marks the file as deleted. The entry passed to
+		// it is a copy, which replaces the archived one once the export has succeeded.
+		using PayloadProvider = std::function<bool(uint32_t, FileInfo &, std::vector<uint8_t> &)>;
+		bool Export(const PayloadProvider &payloadProvider, ExportMode mode = ExportMode::Rewrite);
+		bool CanAppend() const;
+		// Entries that are kept by compaction
+		std::vector<bool> GetLiveEntries() const;
+		bool ExportAppend(const PayloadProvider &payloadProvider);
 
 		bool ReadHeader();
-		void ReadVersionLayer();
-		void ReadFiles();
-		void ReadFileNames();
-		void ReadFileHierarchy();
+		// Reads the section between the two offsets (relative to m_inFileStartOffset) with a single read
+		bool ReadSection(uint64_t begin, uint64_t end, void *data) const;
+		void ReadVersionLayer(std::span<const uint8_t> data) const;
+		void BuildVersionIndex() const;
+		bool IsCurrentVersionEntry(const VersionInfo &info, uint32_t idx) const;
+		// Removes superseded entries from the file lists
+		void PruneVersions();
+		void PruneVersion(VersionInfo &info);
+		void ReadFiles(std::span<const uint8_t> data) const;
+		void ReadFileNames(std::unique_ptr<char[]> data, size_t size) const;
+		void ReadFileHierarchy(std::span<const uint8_t> data) const;
+		void BuildPathIndex() const;
+		// Versions
+		void LoadVersionLayer() const;
+		// File headers and names
+		void LoadFileLayer() const;
+		// Hierarchy and path index, implies LoadFileLayer
+		void LoadIndexLayer() const;
+		// Relative path of every entry, using the system directory separator
+		std::vector<std::string> GetRelativePaths() const;
+		void OpenNativeFile();
+		// Returns INVALID_INDEX if there is no such entry
+		uint32_t LookupPath(const std::string &fname) const;
+		// Child of 'parent' whose full path has the specified hash and which is called 'name'
+		uint32_t FindChild(uint32_t parent, uint64_t pathHash, std::string_view name) const;
+		bool MatchesPath(uint32_t idx, std::string_view path) const;
 		void ReadFileData(uint64_t startOffset, const FileInfo &fi, std::vector<uint8_t> &data) const;
+		// Reads data.size() bytes of the compressed payload, starting at 'offset' relative to the payload
+		bool ReadFileData(uint64_t startOffset, const FileInfo &fi, uint64_t offset, std::span<uint8_t> data) const;
 
 		void WriteHeader(uint64_t &hdVersionOffset, uint64_t &hdFileOffset, uint64_t &hdFileNameOffset, uint64_t &hdHierarchyOffset, uint64_t &hdDataOffset);
 		void WriteVersionLayer();
 		void WriteFiles(uint64_t &fileHeaderOffset);
-		void WriteFileNames(uint64_t startOffset, uint64_t fileHeaderOffset);
+		void WriteFileNames(uint64_t startOffset, std::vector<FileHeader> &headers);
 		void WriteFileHierarchy();
-		void WriteFileData(uint64_t startOffset, uint64_t fileHeaderOffset);
+		// If keepExistingPayloads is set, only new payloads are written and all other files keep their current offsets.
+		// If outFile is a native handle to the output file, existing payloads are copied into it directly.
+		// Entries updated by the payload provider are returned in outStagedFiles, m_files is left unchanged.
+		void WriteFileData(uint64_t startOffset, std::vector<FileHeader> &headers, std::vector<std::pair<uint32_t, FileInfo>> &outStagedFiles, const PayloadProvider &payloadProvider, bool keepExistingPayloads = false, NativeFile *outFile = nullptr);
+		void WriteFileHeaders(uint64_t fileHeaderOffset, const std::vector<FileHeader> &headers);
 		void Close();
 	};
+
+	// Sequential reads decompress the file incrementally with bounded memory usage. Seeking forward skips ahead in the
+	// stream, seeking backward restarts it. Chunked files only decompress the chunk at the current position; uncompressed
+	// and solid files as well as files in the data cache are read directly. A stream must not be shared between threads,
+	// but any number of streams may be open at once.
+	class DLLUVA ArchiveFile::FileStream {
+	  public:
+		// 'idx' has to refer to a file
+		FileStream(const ArchiveFile &archive, uint32_t idx);
+		// Returns the number of bytes read, which is less than 'size' at the end of the file or if the data couldn't be decompressed
+		uint64_t Read(void *data, uint64_t size);
+		// Offsets past the end are allowed, reads from there return 0
+		void Seek(uint64_t offset);
+		uint64_t Tell() const;
+		// Uncompressed size
+		uint64_t GetSize() const;
+		bool Eof() const;
+		const FileInfo &GetFileInfo() const;
+	  private:
+		// Makes sure the window contains m_position, m_position has to be smaller than the file size
+		bool FillWindow();
+		bool DecodeNextWindow();
+		void ResetDecoder();
+		const ArchiveFile &m_archive;
+		FileInfo m_fileInfo;
+		uint64_t m_position = 0;
+		// Set if the entire file is available in memory, the file data starts at m_dataOffset
+		std::shared_ptr<const std::vector<uint8_t>> m_data = nullptr;
+		uint64_t m_dataOffset = 0;
+		std::optional<ChunkTable> m_chunkTable {};
+		// Decompressed range [m_windowStart, m_windowStart +m_window.size()) of the file
+		std::vector<uint8_t> m_window;
+		uint64_t m_windowStart = 0;
+		std::unique_ptr<Decoder> m_decoder = nullptr;
+		std::vector<uint8_t> m_readBuffer;
+		std::span<const uint8_t> m_in;
+		// Position in the compressed payload of the next read
+		uint64_t m_readOffset = 0;
+	};
+
+	// Handle to the extraction started by ArchiveFile::ExtractDataAsync. Destroying it cancels the files that haven't been
+	// started yet and waits for the others.
+	class DLLUVA ArchiveFile::ExtractBatch {
+	  public:
+		ExtractBatch(uint32_t numThreads, size_t numRequests, const BatchCallback &callback);
+		ExtractBatch(const ExtractBatch &) = delete;
+		ExtractBatch &operator=(const ExtractBatch &) = delete;
+		~ExtractBatch();
+		// Blocks until every file has been handed to the callback or skipped due to Cancel
+		void Wait();
+		bool IsComplete() const;
+		// Files that haven't been started yet are skipped, the callback isn't called for them
+		void Cancel();
+		// Including failed files
+		size_t GetNumCompleted() const;
+		size_t GetNumFailed() const;
+	  private:
+		friend ArchiveFile;
+		void Complete(size_t requestIdx, const std::shared_ptr<const std::vector<uint8_t>> &data);
+		void Skip(size_t numRequests);
+		bool IsCancelled() const;
+		std::unique_ptr<ThreadPool> m_pool;
+		BatchCallback m_callback;
+		std::mutex m_callbackMutex;
+		size_t m_numRequests = 0;
+		std::atomic<size_t> m_numCompleted = 0;
+		std::atomic<size_t> m_numFailed = 0;
+		std::atomic<size_t> m_numSkipped = 0;
+		std::atomic<bool> m_cancelled = false;
+	};
+};
+export {
+	REGISTER_ENUM_FLAGS(pragma::uva::ArchiveFile::OpenFlags)
 };
@@ -0,0 +1,171 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+module pragma.uva;
+
+import :thread_pool;
+
+#undef max
+
+pragma::uva::ArchiveFile::ExtractBatch::ExtractBatch(uint32_t numThreads, size_t numRequests, const BatchCallback &callback)
+	: m_pool {std::make_unique<ThreadPool>(numThreads)}, m_callback {callback}, m_numRequests {numRequests}
+{
+}
+
+pragma::uva::ArchiveFile::ExtractBatch::~ExtractBatch()
+{
+	Cancel();
+	Wait();
+}
+
+void pragma::uva::ArchiveFile::ExtractBatch::Wait() { m_pool->Wait(); }
+bool pragma::uva::ArchiveFile::ExtractBatch::IsComplete() const { return m_numCompleted + m_numSkipped == m_numRequests; }
+void pragma::uva::ArchiveFile::ExtractBatch::Cancel() { m_cancelled = true; }
+bool pragma::uva::ArchiveFile::ExtractBatch::IsCancelled() const { return m_cancelled; }
+size_t pragma::uva::ArchiveFile::ExtractBatch::GetNumCompleted() const { return m_numCompleted; }
+size_t pragma::uva::ArchiveFile::ExtractBatch::GetNumFailed() const { return m_numFailed; }
+void pragma::uva::ArchiveFile::ExtractBatch::Skip(size_t numRequests) { m_numSkipped += numRequests; }
+
+void pragma::uva::ArchiveFile::ExtractBatch::Complete(size_t requestIdx, const std::shared_ptr<const std::vector<uint8_t>> &data)
+{
+	if(data == nullptr)
+		++m_numFailed;
+	if(m_callback != nullptr) {
+		std::scoped_lock lock {m_callbackMutex};
+		m_callback(requestIdx, data);
+	}
+	++m_numCompleted;
+}
+
+std::unique_ptr<pragma::uva::ArchiveFile::ExtractBatch> pragma::uva::ArchiveFile::ExtractDataAsync(const std::vector<std::string> &fileNames, const BatchCallback &callback, const BatchExtractOptions &options) const
+{
+	std::vector<uint32_t> fileIndices;
+	fileIndices.reserve(fileNames.size());
+	for(auto &fname : fileNames) {
+		uint32_t idx = 0;
+		fileIndices.push_back((FindFile(fname, idx) != nullptr) ? idx : INVALID_INDEX);
+	}
+	return ExtractDataAsync(fileIndices, callback, options);
+}
+
+std::unique_ptr<pragma::uva::ArchiveFile::ExtractBatch> pragma::uva::ArchiveFile::ExtractDataAsync(const std::vector<uint32_t> &fileIndices, const BatchCallback &callback, const BatchExtractOptions &options) const
+{
+	LoadFileLayer();
+	auto batch = std::make_unique<ExtractBatch>(ThreadPool::get_thread_count(options.numThreads), fileIndices.size(), callback);
+	auto *pBatch = batch.get();
+
+	// Files that don't require any reads (missing, empty or cached) are completed by the first task. Files of the same
+	// solid block share a task, so the block is only decompressed once. If the archive is memory-mapped, or if the
+	// payload is too large to be read in one go, every file is a task of its own. All other payloads are grouped into
+	// ranges of the archive that can be fetched with a single read.
+	using Request = std::pair<size_t, uint32_t>;
+	std::vector<Request> immediate;
+	std::map<uint64_t, std::vector<Request>> solidBlocks;
+	std::vector<Request> single;
+	std::vector<Request> coalesced;
+	auto mapped = IsMemoryMapped();
+	for(size_t i = 0; i < fileIndices.size(); ++i) {
+		auto idx = fileIndices.at(i);
+		if(idx >= m_files.size() || m_files.at(idx).IsFile() == false || m_files.at(idx).sizeUncompressed == 0 || m_dataCache.Find(idx) != nullptr) {
+			immediate.push_back({i, idx});
+			continue;
+		}
+		auto &fi = m_files.at(idx);
+		if(fi.IsSolid())
+			solidBlocks[fi.offset].push_back({i, idx});
+		else if(mapped || fi.data != nullptr || fi.size > options.maxReadSize)
+			single.push_back({i, idx});
+		else
+			coalesced.push_back({i, idx});
+	}
+
+	auto fDecompress = [this](const FileInfo &fi, uint32_t idx, std::span<const uint8_t> payload) -> std::shared_ptr<const std::vector<uint8_t>> {
+		auto data = std::make_shared<std::vector<uint8_t>>(fi.sizeUncompressed);
+		auto success = payload.empty() ? Decompress(fi, *data) : DecompressPayload(fi, payload, *data);
+		if(success == false)
+			return nullptr;
+		m_dataCache.Add(idx, data);
+		return data;
+	};
+	auto &pool = *batch->m_pool;
+	if(immediate.empty() == false) {
+		pool.Submit([this, pBatch, immediate = std::move(immediate)]() {
+			for(auto &[requestIdx, idx] : immediate) {
+				if(idx >= m_files.size() || m_files.at(idx).IsFile() == false)
+					pBatch->Complete(requestIdx, nullptr);
+				else if(m_files.at(idx).sizeUncompressed == 0)
+					pBatch->Complete(requestIdx, std::make_shared<std::vector<uint8_t>>());
+				else
+					pBatch->Complete(requestIdx, GetData(idx));
+			}
+		});
+	}
+
+	// Tasks are submitted in the order of the payloads in the archive
+	std::vector<std::pair<uint64_t, ThreadPool::Task>> tasks;
+	for(auto &[offset, requests] : solidBlocks) {
+		tasks.push_back({offset, [this, pBatch, requests = std::move(requests)]() {
+			if(pBatch->IsCancelled()) {
+				pBatch->Skip(requests.size());
+				return;
+			}
+			auto block = GetSolidBlock(m_files.at(requests.front().second));
+			for(auto &[requestIdx, idx] : requests) {
+				auto &fi = m_files.at(idx);
+				if(block == nullptr || fi.blockOffset > block->size() || fi.sizeUncompressed > block->size() - fi.blockOffset) {
+					pBatch->Complete(requestIdx, nullptr);
+					continue;
+				}
+				auto data = std::make_shared<std::vector<uint8_t>>(block->begin() + fi.blockOffset, block->begin() + fi.blockOffset + fi.sizeUncompressed);
+				m_dataCache.Add(idx, data);
+				pBatch->Complete(requestIdx, data);
+			}
+		}});
+	}
+	for(auto &request : single) {
+		tasks.push_back({m_files.at(request.second).offset, [this, pBatch, request, fDecompress]() {
+			if(pBatch->IsCancelled()) {
+				pBatch->Skip(1);
+				return;
+			}
+			pBatch->Complete(request.first, fDecompress(m_files.at(request.second), request.second, {}));
+		}});
+	}
+
+	std::sort(coalesced.begin(), coalesced.end(), [this](const Request &a, const Request &b) { return m_files.at(a.second).offset < m_files.at(b.second).offset; });
+	for(size_t i = 0; i < coalesced.size();) {
+		auto &first = m_files.at(coalesced.at(i).second);
+		FileInfo range {};
+		range.offset = first.offset;
+		range.size = first.size;
+		auto end = i + 1;
+		for(; end < coalesced.size(); ++end) {
+			auto &fi = m_files.at(coalesced.at(end).second);
+			auto rangeEnd = range.offset + range.size;
+			auto newRangeEnd = std::max(rangeEnd, fi.offset + fi.size);
+			if(fi.offset > rangeEnd + options.maxReadGap || newRangeEnd - range.offset > options.maxReadSize)
+				break;
+			range.size = newRangeEnd - range.offset;
+		}
+		std::vector<Request> requests {coalesced.begin() + i, coalesced.begin() + end};
+		tasks.push_back({range.offset, [this, pBatch, range, requests = std::move(requests), fDecompress]() {
+			if(pBatch->IsCancelled()) {
+				pBatch->Skip(requests.size());
+				return;
+			}
+			std::vector<uint8_t> payloads(range.size);
+			auto success = ReadFileData(m_inFileStartOffset, range, 0, payloads);
+			for(auto &[requestIdx, idx] : requests) {
+				auto &fi = m_files.at(idx);
+				pBatch->Complete(requestIdx, success ? fDecompress(fi, idx, std::span<const uint8_t> {payloads.data() + (fi.offset - range.offset), fi.size}) : nullptr);
+			}
+		}});
+		i = end;
+	}
+	std::stable_sort(tasks.begin(), tasks.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+	for(auto &[offset, task] : tasks)
+		pool.Submit(std::move(task));
+	return batch;
+}
@@ -0,0 +1,250 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+module pragma.uva;
+
+import :checksum;
+import :delta;
+
+bool pragma::uva::ArchiveFile::CreatePatch(ArchiveFile &base, const std::string &patchFileName, const PatchOptions &options)
+{
+	util::Version baseVersion {};
+	auto hasBaseVersion = base.GetLatestVersion(&baseVersion);
+	// Newest first
+	std::vector<const VersionInfo *> newVersions;
+	for(auto &info : GetVersions()) {
+		if(hasBaseVersion && info.version <= baseVersion)
+			break;
+		newVersions.push_back(&info);
+	}
+	if(newVersions.empty())
+		return false;
+
+	if(FileManager::ExistsSystem(patchFileName.c_str()) && FileManager::RemoveSystemFile(patchFileName.c_str()) == false)
+		return false;
+	auto patch = std::unique_ptr<ArchiveFile>(Open(patchFileName));
+	if(patch == nullptr)
+		return false;
+	auto paths = GetRelativePaths();
+	uint64_t numDeltaBytes = 0;
+	uint64_t numFullBytes = 0;
+	std::vector<uint8_t> baseData;
+	std::vector<uint8_t> targetData;
+	std::vector<uint8_t> delta;
+	std::vector<VersionInfo> patchVersions;
+	for(auto *info : newVersions) {
+		VersionInfo patchVersion;
+		patchVersion.version = info->version;
+		for(auto idx : info->files) {
+			if(idx >= m_files.size() || paths.at(idx).empty())
+				continue;
+			auto &fi = m_files.at(idx);
+			auto &path = paths.at(idx);
+			uint32_t patchIdx;
+			auto *pfi = patch->AddFile(path, patchIdx);
+			patchVersion.files.push_back(patchIdx);
+			pfi->flags = fi.flags & ~FileInfo::Flags::Solid;
+			if(fi.IsDirectory() || fi.size == 0) {
+				pfi->size = 0;
+				pfi->sizeUncompressed = 0;
+				continue;
+			}
+
+			auto *baseFi = base.FindFile(path);
+			if(baseFi != nullptr && baseFi->IsFile() && baseFi->size > 0 && base.ExtractData(path, baseData)) {
+				if(ExtractData(path, targetData) == false) {
+					std::cout << "WARNING: Unable to extract file '" << path << "'!" << std::endl;
+					return false;
+				}
+				create_delta(baseData, targetData, fi.GetCodec(), delta);
+				auto compressedDelta = std::make_shared<std::vector<uint8_t>>();
+				if(compress(options.codec, delta, *compressedDelta) && static_cast<double>(compressedDelta->size()) < static_cast<double>(fi.size) * options.maxDeltaRatio) {
+					pfi->flags &= ~FileInfo::Flags::Chunked;
+					pfi->flags |= FileInfo::Flags::Delta;
+					pfi->SetCodec(options.codec);
+					pfi->crc = calc_crc32(delta);
+					pfi->contentHash = calc_content_hash(delta);
+					pfi->sizeUncompressed = delta.size();
+					pfi->size = compressedDelta->size();
+					pfi->data = compressedDelta;
+					numDeltaBytes += compressedDelta->size();
+					continue;
+				}
+			}
+
+			// The payload is taken over as it is, without decompressing it. Files of solid blocks are stored on their own.
+			auto payload = std::make_shared<std::vector<uint8_t>>();
+			if(fi.IsSolid()) {
+				auto codec = fi.GetCodec();
+				if(ExtractData(path, targetData) == false || compress(codec, targetData, *payload) == false) {
+					std::cout << "WARNING: Unable to extract file '" << path << "'!" << std::endl;
+					return false;
+				}
+				pfi->SetCodec(codec);
+				pfi->crc = fi.crc;
+				pfi->contentHash = fi.contentHash;
+				pfi->sizeUncompressed = fi.sizeUncompressed;
+				pfi->size = payload->size();
+				pfi->data = payload;
+				numFullBytes += payload->size();
+				continue;
+			}
+			if(fi.data != nullptr)
+				*payload = *fi.data;
+			else
+				ReadFileData(m_inFileStartOffset, fi, *payload);
+			if(payload->size() != fi.size) {
+				std::cout << "WARNING: Unable to read payload of file '" << path << "'!" << std::endl;
+				return false;
+			}
+			pfi->crc = fi.crc;
+			pfi->contentHash = fi.contentHash;
+			pfi->sizeUncompressed = fi.sizeUncompressed;
+			pfi->size = fi.size;
+			pfi->data = payload;
+			numFullBytes += fi.size;
+		}
+		patchVersions.push_back(std::move(patchVersion));
+	}
+	// The version the patch applies to is recorded as the oldest version, without any files (see ApplyPatch)
+	if(hasBaseVersion) {
+		VersionInfo baseInfo;
+		baseInfo.version = baseVersion;
+		patch->AddVersion(baseInfo);
+	}
+	// Oldest first, AddVersion expects the versions in ascending order
+	for(auto it = patchVersions.rbegin(); it != patchVersions.rend(); ++it)
+		patch->AddVersion(*it);
+	if(patch->Export() == false)
+		return false;
+#ifdef UVA_VERBOSE
+	std::cout << "Patch contains " << numDeltaBytes << " bytes of deltas and " << numFullBytes << " bytes of full files." << std::endl;
+#endif
+	return true;
+}
+
+bool pragma::uva::ArchiveFile::ApplyPatch(const std::string &patchFileName, ExportMode mode)
+{
+	auto patch = std::unique_ptr<ArchiveFile>(Open(patchFileName));
+	if(patch == nullptr)
+		return false;
+	auto &patchVersions = patch->GetVersions();
+	if(patchVersions.empty())
+		return false;
+	// Only the version the patch was created against has the files the deltas refer to. A patch without a base version
+	// was created against an archive without any versions.
+	std::optional<util::Version> baseVersion {};
+	auto numPatchVersions = patchVersions.size();
+	if(patchVersions.back().files.empty()) {
+		baseVersion = patchVersions.back().version;
+		--numPatchVersions;
+	}
+	if(numPatchVersions == 0)
+		return false;
+	util::Version version {};
+	auto hasVersion = GetLatestVersion(&version);
+	if(hasVersion != baseVersion.has_value() || (hasVersion && version != *baseVersion)) {
+		std::cout << "WARNING: Patch '" << patchFileName << "' applies to " << (baseVersion.has_value() ? ("version " + baseVersion->ToString()) : "an archive without versions") << ", but the archive is at "
+		          << (hasVersion ? ("version " + version.ToString()) : "no version") << "!" << std::endl;
+		return false;
+	}
+
+	// All files are rebuilt before anything is changed, so the index is left untouched if any of them can't be patched
+	auto paths = patch->GetRelativePaths();
+	auto &patchFiles = patch->GetFiles();
+	std::unordered_map<uint32_t, FileInfo> patchedFiles;
+	std::vector<uint8_t> baseData;
+	std::vector<uint8_t> delta;
+	std::vector<uint8_t> targetData;
+	for(auto &info : patchVersions) {
+		for(auto patchIdx : info.files) {
+			if(patchIdx >= patchFiles.size() || paths.at(patchIdx).empty())
+				return false;
+			auto &pfi = patchFiles.at(patchIdx);
+			auto &path = paths.at(patchIdx);
+			FileInfo fi {};
+			fi.flags = pfi.flags & ~FileInfo::Flags::Delta;
+			if(pfi.IsDirectory() || pfi.size == 0) {
+				patchedFiles[patchIdx] = fi;
+				continue;
+			}
+			if((pfi.flags & FileInfo::Flags::Delta) == FileInfo::Flags::None) {
+				auto payload = std::make_shared<std::vector<uint8_t>>();
+				patch->ReadFileData(patch->m_inFileStartOffset, pfi, *payload);
+				if(payload->size() != pfi.size) {
+					std::cout << "WARNING: Unable to read file '" << path << "' from patch!" << std::endl;
+					return false;
+				}
+				fi.crc = pfi.crc;
+				fi.contentHash = pfi.contentHash;
+				fi.sizeUncompressed = pfi.sizeUncompressed;
+				fi.size = pfi.size;
+				fi.data = payload;
+				patchedFiles[patchIdx] = fi;
+				continue;
+			}
+
+			Codec codec;
+			if(patch->ExtractData(path, delta) == false || ExtractData(path, baseData) == false || apply_delta(baseData, delta, targetData, codec) == false) {
+				std::cout << "WARNING: Unable to apply patch to file '" << path << "'!" << std::endl;
+				return false;
+			}
+			if(is_codec_available(codec) == false)
+				codec = Codec::Bzip2;
+			auto payload = std::make_shared<std::vector<uint8_t>>();
+			if(compress(codec, targetData, *payload) == false) {
+				codec = Codec::Store;
+				*payload = targetData;
+			}
+			fi.flags &= ~FileInfo::Flags::Chunked;
+			fi.SetCodec(codec);
+			fi.crc = calc_crc32(targetData);
+			fi.contentHash = calc_content_hash(targetData);
+			fi.sizeUncompressed = targetData.size();
+			fi.size = payload->size();
+			fi.data = payload;
+			patchedFiles[patchIdx] = fi;
+		}
+	}
+
+	// The entries are updated before the export, restore the previous index if it fails. Names added to the pool in the
+	// meantime are no longer referenced and aren't written.
+	LoadIndexLayer();
+	auto files = m_files;
+	auto hierarchy = m_hierarchy;
+	auto versions = m_versions;
+	for(auto it = patchVersions.rend() - numPatchVersions; it != patchVersions.rend(); ++it) {
+		VersionInfo newVersion;
+		newVersion.version = it->version;
+		for(auto patchIdx : it->files) {
+			uint32_t idx;
+			auto *fi = FindFile(paths.at(patchIdx), idx);
+			if(fi == nullptr)
+				fi = AddFile(paths.at(patchIdx), idx);
+			auto &patched = patchedFiles.at(patchIdx);
+			fi->flags = patched.flags;
+			fi->crc = patched.crc;
+			fi->contentHash = patched.contentHash;
+			fi->sizeUncompressed = patched.sizeUncompressed;
+			fi->size = patched.size;
+			fi->blockOffset = 0;
+			fi->blockSize = 0;
+			// The content doesn't come from a source file anymore, the next publish has to compare it
+			fi->sourceStat = {};
+			fi->data = patched.data;
+			newVersion.files.push_back(idx);
+		}
+		AddVersion(newVersion);
+	}
+	if(Export(mode) == false) {
+		m_files = std::move(files);
+		m_hierarchy = std::move(hierarchy);
+		m_versions = std::move(versions);
+		BuildVersionIndex();
+		BuildPathIndex();
+		return false;
+	}
+	return true;
+}
@@ -20,7 +20,11 @@ module;
 
 module pragma.uva;
 
+import :checksum;
+import :directory_walker;
+import :native_file;
 import :os_info;
+import :thread_pool;
 
 std::string pragma::uva::ArchiveFile::result_code_to_string(UpdateResult code)
 {
@@ -42,8 +46,255 @@ std::string pragma::uva::ArchiveFile::result_code_to_string(UpdateResult code)
 	}
 }
 
+// Case-insensitive key for archive paths, independent of the directory separator
+static std::string get_path_key(std::string_view path)
+{
+	std::string key;
+	key.reserve(path.size());
+	for(auto c : path) {
+		if(c == '\\' || c == '/') {
+			if(key.empty() == false && key.back() != '/')
+				key += '/';
+			continue;
+		}
+		key += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	}
+	if(key.empty() == false && key.back() == '/')
+		key.pop_back();
+	return key;
+}
+
+// Three-stage publish pipeline: A reader thread loads (and translates) the files in list order, a thread pool
+// compresses them, and the caller consumes the results in list order through Next. Memory usage is bounded by
+// PublishOptions::maxBufferedBytes, the reader stalls until enough results have been consumed.
+class PublishPipeline {
+  public:
+	using TranslateCallback = std::function<void(std::string &, std::string &, std::vector<uint8_t> &)>;
+	// Called from the pool threads with the archive name, content hash and size of a file, has to be thread-safe
+	using UnchangedCallback = std::function<bool(const std::string &, uint64_t, uint64_t)>;
+	// Called from the reader thread with the archive name (prior to translation) and stat of a file before it is read
+	using StatUnchangedCallback = std::function<bool(const std::string &, const pragma::uva::FileStat &)>;
+	struct Result {
+		// File doesn't exist or is empty
+		bool deleted = false;
+		// Content is identical to the archived version, the file hasn't been compressed. If the stat matched, it hasn't been read either.
+		bool unchanged = false;
+		// Small file that goes into a solid block, compressedData holds the uncompressed data
+		bool solid = false;
+		// compressedData is a chunked payload (see PublishOptions::chunkSize)
+		bool chunked = false;
+		pragma::uva::Codec codec = pragma::uva::Codec::Store;
+		// Archive name, after translation
+		std::string srcName;
+		std::vector<uint8_t> compressedData;
+		uint64_t sizeUncompressed = 0;
+		uint32_t crc = 0;
+		uint64_t contentHash = 0;
+		// Stat of the source file prior to reading it, if known
+		std::optional<pragma::uva::FileStat> stat {};
+	};
+	// sourceNames holds the archive name (PublishInfo::GetSourceName) of every file
+	PublishPipeline(const std::vector<pragma::uva::PublishInfo> &files, const std::vector<std::string> &sourceNames, const pragma::uva::PublishOptions &options, const TranslateCallback &translateCallback, const UnchangedCallback &unchangedCallback = nullptr,
+	  const StatUnchangedCallback &statUnchangedCallback = nullptr);
+	~PublishPipeline();
+	// Blocks until the next file has been processed
+	Result Next();
+	uint64_t GetNumBytesRead() const;
+  private:
+	struct Slot {
+		bool ready = false;
+		// The data of the file counts towards the buffer budget until the result has been consumed
+		bool buffered = false;
+		Result result;
+	};
+	void Read();
+	void Compress(size_t idx, const std::string &srcName, std::vector<uint8_t> data);
+	const std::vector<pragma::uva::PublishInfo> &m_files;
+	const std::vector<std::string> &m_sourceNames;
+	const pragma::uva::PublishOptions &m_options;
+	TranslateCallback m_translateCallback;
+	UnchangedCallback m_unchangedCallback;
+	StatUnchangedCallback m_statUnchangedCallback;
+	std::vector<Slot> m_slots;
+	size_t m_nextSlot = 0;
+	std::atomic<uint64_t> m_numBytesRead = 0;
+
+	std::mutex m_mutex;
+	std::condition_variable m_slotReady;
+	std::condition_variable m_bufferAvailable;
+	uint64_t m_bufferedBytes = 0;
+	uint32_t m_numBuffered = 0;
+	bool m_cancel = false;
+
+	std::thread m_reader;
+	// Declared last, so that it is destroyed (and finishes its tasks) before the state above
+	pragma::uva::ThreadPool m_pool;
+};
+
+PublishPipeline::PublishPipeline(const std::vector<pragma::uva::PublishInfo> &files, const std::vector<std::string> &sourceNames, const pragma::uva::PublishOptions &options, const TranslateCallback &translateCallback, const UnchangedCallback &unchangedCallback,
+  const StatUnchangedCallback &statUnchangedCallback)
+    : m_files {files}, m_sourceNames {sourceNames}, m_options {options}, m_translateCallback {translateCallback}, m_unchangedCallback {unchangedCallback}, m_statUnchangedCallback {statUnchangedCallback}, m_slots(files.size()), m_pool {options.numThreads}
+{
+	m_reader = std::thread {[this]() { Read(); }};
+}
+
+PublishPipeline::~PublishPipeline()
+{
+	{
+		std::scoped_lock lock {m_mutex};
+		m_cancel = true;
+	}
+	m_bufferAvailable.notify_all();
+	m_reader.join();
+}
+
+uint64_t PublishPipeline::GetNumBytesRead() const { return m_numBytesRead; }
+
+void PublishPipeline::Read()
+{
+	for(auto i = decltype(m_files.size()) {0}; i < m_files.size(); ++i) {
+		auto &file = m_files.at(i);
+		{
+			// If the size is known from the directory walk, the file is only read once it fits into the budget
+			auto size = file.stat.has_value() ? file.stat->size : 0;
+			std::unique_lock lock {m_mutex};
+			m_bufferAvailable.wait(lock, [this, size]() { return m_cancel || m_numBuffered == 0 || m_bufferedBytes + size < m_options.maxBufferedBytes; });
+			if(m_cancel)
+				return;
+		}
+		auto srcName = m_sourceNames.at(i);
+		auto stat = file.stat;
+		if(stat.has_value() == false) {
+			pragma::uva::FileStat fileStat;
+			if(pragma::uva::get_file_stat(file.file, fileStat))
+				stat = fileStat;
+		}
+		if(stat.has_value() && m_statUnchangedCallback != nullptr && m_statUnchangedCallback(srcName, *stat)) {
+			std::unique_lock lock {m_mutex};
+			auto &slot = m_slots.at(i);
+			slot.result.srcName = std::move(srcName);
+			slot.result.unchanged = true;
+			slot.result.stat = stat;
+			slot.ready = true;
+			lock.unlock();
+			m_slotReady.notify_all();
+			continue;
+		}
+		std::vector<uint8_t> data;
+		auto fptr = FileManager::OpenSystemFile(file.file.c_str(), "rb");
+		if(fptr != nullptr) {
+			data.resize(fptr->GetSize());
+			if(data.empty() == false) {
+				fptr->Read(data.data(), data.size());
+				m_numBytesRead += data.size();
+				if(m_translateCallback != nullptr) {
+					auto fileName = file.file;
+					m_translateCallback(fileName, srcName, data);
+				}
+			}
+			fptr = nullptr;
+		}
+		std::unique_lock lock {m_mutex};
+		auto &result = m_slots.at(i).result;
+		result.srcName = srcName;
+		result.stat = stat;
+		if(data.empty()) {
+			result.deleted = true;
+			m_slots.at(i).ready = true;
+			lock.unlock();
+			m_slotReady.notify_all();
+			continue;
+		}
+		m_bufferedBytes += data.size();
+		++m_numBuffered;
+		m_slots.at(i).buffered = true;
+		lock.unlock();
+		m_pool.Submit([this, i, srcName = std::move(srcName), data = std::move(data)]() mutable { Compress(i, srcName, std::move(data)); });
+	}
+}
+
+void PublishPipeline::Compress(size_t idx, const std::string &srcName, std::vector<uint8_t> data)
+{
+	auto contentHash = pragma::uva::calc_content_hash(data);
+	if(m_unchangedCallback != nullptr && m_unchangedCallback(srcName, contentHash, data.size())) {
+		std::unique_lock lock {m_mutex};
+		auto &slot = m_slots.at(idx);
+		slot.result.unchanged = true;
+		slot.result.sizeUncompressed = data.size();
+		slot.result.contentHash = contentHash;
+		m_bufferedBytes -= data.size();
+		slot.ready = true;
+		lock.unlock();
+		m_slotReady.notify_all();
+		m_bufferAvailable.notify_one();
+		return;
+	}
+	if(m_options.solidBlockSize > 0 && data.size() <= m_options.solidFileSizeLimit && m_files.at(idx).codec.has_value() == false) {
+		auto crc = pragma::uva::calc_crc32(data);
+		std::unique_lock lock {m_mutex};
+		auto &slot = m_slots.at(idx);
+		slot.result.solid = true;
+		slot.result.sizeUncompressed = data.size();
+		slot.result.crc = crc;
+		slot.result.contentHash = contentHash;
+		slot.result.compressedData = std::move(data);
+		slot.ready = true;
+		lock.unlock();
+		m_slotReady.notify_all();
+		return;
+	}
+	auto codec = m_files.at(idx).codec.value_or(m_options.codec);
+	if(pragma::uva::is_codec_available(codec) == false) {
+		std::cout << "WARNING: Codec '" << pragma::uva::codec_to_string(codec) << "' is not available, falling back to bzip2 for file '" << m_files.at(idx).file << "'!" << std::endl;
+		codec = pragma::uva::Codec::Bzip2;
+	}
+	std::vector<uint8_t> compressedData;
+	auto chunked = (m_options.chunkSize > 0 && data.size() > m_options.chunkSize);
+	auto success = chunked ? pragma::uva::compress_chunked(codec, data, m_options.chunkSize, compressedData) : pragma::uva::compress(codec, data, compressedData);
+	if(success == false)
+		std::cout << "WARNING: Unable to compress file '" << m_files.at(idx).file << "', storing it uncompressed!" << std::endl;
+	auto crc = pragma::uva::calc_crc32(data);
+	auto sizeUncompressed = data.size();
+	// Uncompressed files can be read in ranges as they are, they don't need to be chunked
+	if(success == false || static_cast<double>(compressedData.size()) >= static_cast<double>(data.size()) * m_options.storeThreshold) {
+		codec = pragma::uva::Codec::Store;
+		chunked = false;
+		compressedData = std::move(data);
+	}
+
+	std::unique_lock lock {m_mutex};
+	auto &slot = m_slots.at(idx);
+	slot.result.sizeUncompressed = sizeUncompressed;
+	slot.result.crc = crc;
+	slot.result.contentHash = contentHash;
+	slot.result.codec = codec;
+	slot.result.chunked = chunked;
+	slot.result.compressedData = std::move(compressedData);
+	m_bufferedBytes -= sizeUncompressed;
+	m_bufferedBytes += slot.result.compressedData.size();
+	slot.ready = true;
+	lock.unlock();
+	m_slotReady.notify_all();
+	m_bufferAvailable.notify_one();
+}
+
+PublishPipeline::Result PublishPipeline::Next()
+{
+	std::unique_lock lock {m_mutex};
+	auto &slot = m_slots.at(m_nextSlot++);
+	m_slotReady.wait(lock, [&slot]() { return slot.ready; });
+	auto result = std::move(slot.result);
+	if(slot.buffered) {
+		m_bufferedBytes -= result.compressedData.size();
+		--m_numBuffered;
+	}
+	lock.unlock();
+	m_bufferAvailable.notify_one();
+	return result;
+}
+
 pragma::uva::ArchiveFile::UpdateResult pragma::uva::ArchiveFile::PublishUpdate(const std::string &filePath, util::Version &version, std::vector<PublishInfo> &files, const std::string &updateFile, const std::function<bool(VFilePtr &)> &readCallback,
-  const std::function<bool(VFilePtrReal &)> &writeCallback, const std::function<void(std::string &, std::string &, std::vector<uint8_t> &)> &dataTranslateCallback)
+  const std::function<bool(VFilePtrReal &)> &writeCallback, const std::function<void(std::string &, std::string &, std::vector<uint8_t> &)> &dataTranslateCallback, const PublishOptions &options)
 {
 	auto f = std::unique_ptr<ArchiveFile>(pragma::uva::ArchiveFile::Open(updateFile, readCallback, writeCallback));
 	if(f == nullptr)
@@ -77,19 +328,23 @@ pragma::uva::ArchiveFile::UpdateResult pragma::uva::ArchiveFile::PublishUpdate(c
 		//std::transform(name.begin(),name.end(),name.begin(),::tolower);
 	}
 
-	// Remove duplicates
-	for(unsigned int i = static_cast<unsigned int>(files.size()) - 1; i >= 1; i--) {
-		for(unsigned int j = i - 1; j != (unsigned int)-1; j--) {
-			if(files[i] == files[j])
-				files.erase(files.begin() + i);
-		}
+	// Remove duplicates, the first occurrence is kept
+	{
+		std::unordered_set<std::string> keys;
+		keys.reserve(files.size());
+		std::erase_if(files, [&keys](const PublishInfo &info) { return keys.insert(info.file + '|' + std::to_string(umath::to_integral(info.os))).second == false; });
 	}
+	// The archive names are only determined once, GetSourceName has to canonicalize the path
+	std::vector<std::string> sourceNames;
+	sourceNames.reserve(files.size());
+	for(auto &info : files)
+		sourceNames.push_back(info.GetSourceName());
 	// Move changelog to top
-	auto it = std::find_if(files.begin(), files.end(), [](const PublishInfo &info) { return (info.GetSourceName() == "changelog.txt") ? true : false; });
-	if(it != files.end()) {
-		auto v = *it;
-		files.erase(it);
-		files.insert(files.begin(), v);
+	auto it = std::find(sourceNames.begin(), sourceNames.end(), "changelog.txt");
+	if(it != sourceNames.end()) {
+		auto i = it - sourceNames.begin();
+		std::rotate(files.begin(), files.begin() + i, files.begin() + i + 1);
+		std::rotate(sourceNames.begin(), sourceNames.begin() + i, sourceNames.begin() + i + 1);
 	}
 	VersionInfo newVersionInfo;
 	newVersionInfo.version = version;
@@ -117,40 +372,124 @@ pragma::uva::ArchiveFile::UpdateResult pragma::uva::ArchiveFile::PublishUpdate(c
 		}
 	}*/
 	//
+	// Compressed payloads are written to a staging file in list order, so they don't have to be kept in memory until the export
+	auto stagingPath = f->m_systemPath + "_staging.dat";
+	auto staging = FileManager::OpenSystemFile(stagingPath.c_str(), "wb");
+	if(staging == nullptr)
+		return UpdateResult::UnableToCreateArchiveFile;
+	struct StagedPayload {
+		uint64_t offset = 0;
+		uint64_t size = 0;
+	};
+	std::unordered_map<uint32_t, StagedPayload> stagedPayloads;
+	uint64_t stagingSize = 0;
+
+	// Content of the archived files, taken before any changes are made, since the pipeline threads look it up concurrently.
+	// Files with unchanged content are skipped, new or changed files share the payload of an archived file with identical content.
+	struct ArchivedContent {
+		uint64_t contentHash = 0;
+		uint64_t sizeUncompressed = 0;
+		FileStat sourceStat {};
+	};
+	struct ArchivedPayload {
+		uint64_t offset = 0;
+		uint64_t size = 0;
+		uint64_t sizeUncompressed = 0;
+		int32_t crc = 0;
+		Codec codec = Codec::Store;
+		bool chunked = false;
+	};
+	std::unordered_map<std::string, ArchivedContent> archivedContent;
+	std::unordered_map<uint64_t, ArchivedPayload> archivedPayloads;
+	{
+		auto &archivedFiles = f->GetFiles();
+		auto paths = f->GetRelativePaths();
+		for(auto i = decltype(archivedFiles.size()) {0}; i < archivedFiles.size(); ++i) {
+			auto &fi = archivedFiles.at(i);
+			if(fi.IsDirectory() || fi.size == 0 || fi.contentHash == 0 || fi.data != nullptr)
+				continue;
+			archivedContent[get_path_key(paths.at(i))] = {fi.contentHash, fi.sizeUncompressed, fi.sourceStat};
+			if(fi.IsSolid() == false)
+				archivedPayloads.insert({fi.contentHash, {fi.offset, fi.size, fi.sizeUncompressed, fi.crc, fi.GetCodec(), fi.IsChunked()}});
+		}
+	}
+
+	auto tStart = std::chrono::steady_clock::now();
+	auto fContentUnchanged = [&archivedContent](const std::string &srcName, uint64_t contentHash, uint64_t size) -> bool {
+		auto it = archivedContent.find(get_path_key(srcName));
+		return it != archivedContent.end() && it->second.contentHash == contentHash && it->second.sizeUncompressed == size;
+	};
+	// Archive entries without a recorded stat (mtime 0) always have their content compared
+	auto fStatUnchanged = [&archivedContent](const std::string &srcName, const FileStat &stat) -> bool {
+		auto it = archivedContent.find(get_path_key(srcName));
+		if(it == archivedContent.end())
+			return false;
+		auto &sourceStat = it->second.sourceStat;
+		return sourceStat.mtime != 0 && sourceStat.mtime == stat.mtime && sourceStat.size == stat.size && sourceStat.inode == stat.inode;
+	};
+	PublishPipeline pipeline {files, sourceNames, options, dataTranslateCallback, fContentUnchanged, options.skipUnchangedByStat ? PublishPipeline::StatUnchangedCallback {fStatUnchanged} : nullptr};
 	uint32_t idx = 0;
 	uint32_t numUnchanged = 0;
 	uint32_t numAdded = 0;
 	uint32_t numChanged = 0;
 	uint32_t numDeleted = 0;
-	for(auto &file : files) {
-		auto srcName = file.GetSourceName();
+	uint32_t numShared = 0;
+	// Archive names of all listed files after translation, everything else is removed from the archive
+	std::unordered_set<std::string> listedPaths;
+	listedPaths.reserve(files.size());
 
-		uint64_t size = 0;
-		uint64_t sizeUncompressed = 0;
+	// Open solid blocks by directory
+	struct SolidBlock {
 		std::vector<uint8_t> data;
-		auto fptr = FileManager::OpenSystemFile(file.file.c_str(), "rb");
-		if(fptr != nullptr) {
-			sizeUncompressed = fptr->GetSize();
-			if(sizeUncompressed == 0) {
-				size = 0;
-				//#ifdef UVA_VERBOSE
-				std::cout << "Marked file '" << file.file << "' for deletion!" << std::endl;
-				++numDeleted;
-				//#endif
-			}
-			else {
-				data.resize(sizeUncompressed);
-				fptr->Read(data.data(), sizeUncompressed);
-
-				if(dataTranslateCallback != nullptr) {
-					dataTranslateCallback(file.file, srcName, data);
-					sizeUncompressed = data.size();
-				}
-			}
+		std::vector<std::pair<uint32_t, uint64_t>> files; // File index, offset in the block
+	};
+	std::unordered_map<std::string, SolidBlock> solidBlocks;
+	auto blockCodec = options.codec;
+	if(is_codec_available(blockCodec) == false)
+		blockCodec = Codec::Bzip2;
+	auto fFlushSolidBlock = [&f, &options, blockCodec](SolidBlock &block) {
+		if(block.files.empty())
+			return;
+		auto codec = blockCodec;
+		auto payload = std::make_shared<std::vector<uint8_t>>();
+		if(compress(codec, block.data, *payload) == false || static_cast<double>(payload->size()) >= static_cast<double>(block.data.size()) * options.storeThreshold) {
+			codec = Codec::Store;
+			*payload = block.data;
 		}
+		// The files share the payload, Export only writes it once
+		for(auto &[idx, blockOffset] : block.files) {
+			auto *fi = f->GetByIndex(idx);
+			fi->flags |= FileInfo::Flags::Solid;
+			fi->SetCodec(codec);
+			fi->size = payload->size();
+			fi->blockOffset = blockOffset;
+			fi->blockSize = block.data.size();
+			fi->data = payload;
+		}
+		block = {};
+	};
+	for(auto &file : files) {
+		auto result = pipeline.Next();
+		auto &srcName = result.srcName;
+		listedPaths.insert(get_path_key(srcName));
 
 		auto *info = f->FindFile(srcName, idx);
 		auto bExists = (info != nullptr) ? true : false;
+		if(result.unchanged) {
+			if(info == nullptr) {
+				std::cout << "WARNING: Unable to locate unchanged file '" << srcName << "' in archive, skipping!" << std::endl;
+				continue;
+			}
+			info->flags |= FileInfo::os_to_flags(file.os);
+			// Files that have only been touched are recognized by their stat next time. Only written if anything else changed.
+			if(result.stat.has_value())
+				info->sourceStat = *result.stat;
+			++numUnchanged;
+#ifdef UVA_VERBOSE
+			std::cout << "'" << info->name << "' is unchanged." << std::endl;
+#endif
+			continue;
+		}
 		if(info != nullptr) {
 			newVersionInfo.files.push_back(idx);
 #ifdef UVA_VERBOSE
@@ -165,131 +504,86 @@ pragma::uva::ArchiveFile::UpdateResult pragma::uva::ArchiveFile::PublishUpdate(c
 			std::cout << "Adding new file '" << srcName << "' to update" << std::endl;
 			//#endif
 		}
-		/*FileInfo *info = nullptr;
-		bool bExists = false;
-		for(auto j=0;j<fileInfo.size();j++)
-		{
-			FileInfo &fi = fileInfo[j];
-			if(file == fi)
-			{
-				info = &fi;
-				newVersionInfo.files.push_back(j);
-				bExists = true;
-				break;
-			}
-		}*/
-		/*if(info == nullptr)
-		{
-			FileInfo fi;
-			fileInfo.push_back(fi);
-			newVersionInfo.files.push_back(static_cast<unsigned int>(fileInfo.size() -1));
-			info = &fileInfo[fileInfo.size() -1];
-		}*/
-		//info->name = file.GetSourceName();
 		info->flags |= FileInfo::os_to_flags(file.os);
+		info->flags &= ~(FileInfo::Flags::Solid | FileInfo::Flags::Chunked);
+		info->blockOffset = 0;
+		info->blockSize = 0;
+		info->sourceStat = result.stat.value_or(FileStat {});
 
-		if(fptr != nullptr) {
-			info->sizeUncompressed = sizeUncompressed;
-			if(info->sizeUncompressed == 0) {
-				info->size = 0;
-				//#ifdef UVA_VERBOSE
-				std::cout << "Marked file '" << file.file << "' for deletion!" << std::endl;
-				//#endif
-				++numDeleted;
-			}
-			else {
-				//std::cout<<"DATA: "<<data<<std::endl;
-				/*boost::crc_32_type crc;
-				crc.process_bytes(data.data(),info->sizeUncompressed);
-				bool bSkip = false;
-				if(bExists) // Compare with existing version
-				{
-					if(info->crc == crc.checksum())
-					{
-						bSkip = true;
-						numUnchanged++;
-#ifdef UVA_VERBOSE
-						std::cout<<"WARNING: File '"<<info->name<<"' hasn't changed! Skipping..."<<std::endl;
-#endif
-						newVersionInfo.files.pop_back();
-					}
-//#ifdef UVA_VERBOSE
-					else
-					{
-						++numChanged;
-						std::cout<<"'"<<info->name<<"' has been changed."<<std::endl;
-					}
-//#endif
-				}
-#ifdef UVA_VERBOSE
-				else
-					std::cout<<"Adding '"<<info->name<<"'..."<<std::endl;
-#endif
-				if(!bSkip)
-				{
-					info->crc = crc.checksum();
-					int32_t blockSize100k = 8;
-					int32_t verbosity = 0;
-					int32_t workFactor = 30;
-					auto destLength = static_cast<uint32_t>(1.01 *static_cast<double>(info->sizeUncompressed) +600.0);
-					auto dest = std::make_shared<std::vector<uint8_t>>(destLength);
-#ifdef UVA_VERBOSE
-					std::cout<<"Compressing...";
-#endif
-					auto err = BZ2_bzBuffToBuffCompress(reinterpret_cast<char*>(dest->data()),&destLength,reinterpret_cast<char*>(data.data()),static_cast<unsigned int>(info->sizeUncompressed),blockSize100k,verbosity,workFactor);
-					if(err == BZ_OK)
-					{
-#ifdef UVA_VERBOSE
-						std::cout<<" Done!"<<std::endl;
-#endif
-						info->data = std::move(dest);
-						info->size = destLength;
-					}
-					else
-					{
-//#ifdef UVA_VERBOSE
-						std::cout<<std::endl<<"WANRING: Unable to compress file '"<<file.file<<"'! ("<<err<<")"<<std::endl;
-//#endif
-						info->size = 0;
-					}
-				}*/
-			}
-		}
-		else {
+		if(result.deleted) {
 			info->size = 0;
 			info->sizeUncompressed = 0;
 			//#ifdef UVA_VERBOSE
 			std::cout << "Marked file '" << file.file << "' for deletion!" << std::endl;
-			++numDeleted;
 			//#endif
+			++numDeleted;
+			stagedPayloads.erase(idx);
+			continue;
+		}
+		if(bExists) {
+			++numChanged;
+#ifdef UVA_VERBOSE
+			std::cout << "'" << info->name << "' has been changed." << std::endl;
+#endif
+		}
+		info->contentHash = result.contentHash;
+		auto itPayload = archivedPayloads.find(result.contentHash);
+		if(itPayload != archivedPayloads.end() && itPayload->second.sizeUncompressed == result.sizeUncompressed && static_cast<uint32_t>(itPayload->second.crc) == result.crc) {
+			auto &payload = itPayload->second;
+			info->SetCodec(payload.codec);
+			if(payload.chunked)
+				info->flags |= FileInfo::Flags::Chunked;
+			info->crc = payload.crc;
+			info->sizeUncompressed = payload.sizeUncompressed;
+			info->size = payload.size;
+			info->offset = payload.offset;
+			info->data = nullptr;
+			stagedPayloads.erase(idx);
+			++numShared;
+			continue;
+		}
+		if(result.solid) {
+			info->crc = result.crc;
+			info->sizeUncompressed = result.sizeUncompressed;
+			stagedPayloads.erase(idx);
+			auto &block = solidBlocks[get_path_key(ufile::get_path_from_filename(srcName))];
+			block.files.push_back({idx, block.data.size()});
+			block.data.insert(block.data.end(), result.compressedData.begin(), result.compressedData.end());
+			if(block.data.size() >= options.solidBlockSize)
+				fFlushSolidBlock(block);
+			continue;
 		}
+		info->SetCodec(result.codec);
+		if(result.chunked)
+			info->flags |= FileInfo::Flags::Chunked;
+		info->crc = result.crc;
+		info->sizeUncompressed = result.sizeUncompressed;
+		info->size = result.compressedData.size();
+		staging->Write(result.compressedData.data(), result.compressedData.size());
+		stagedPayloads[idx] = {stagingSize, result.compressedData.size()};
+		stagingSize += result.compressedData.size();
 	}
+	for(auto &[path, block] : solidBlocks)
+		fFlushSolidBlock(block);
+	staging = nullptr;
+	auto numBytesRead = pipeline.GetNumBytesRead();
 
 	// Check for removed files, has to be done after data translation!
-	auto &root = f->GetRoot();
-	std::function<void(pragma::uva::ArchiveFile::FileIndexInfo &, std::string)> fIterateHierarchy = nullptr;
-	fIterateHierarchy = [&fIterateHierarchy, &f, &files, &newVersionInfo, &numDeleted](pragma::uva::ArchiveFile::FileIndexInfo &fii, std::string path) {
-		if(path.empty() == false)
-			path += "\\";
-		auto fi = f->GetByIndex(fii.index);
-		path += fi->name;
-		if(fi->IsDirectory() == false && fi->size > 0) {
-			auto it = std::find_if(files.begin(), files.end(), [&path](const PublishInfo &pi) { return ustring::compare(path, pi.GetSourceName(), false); });
-			if(it == files.end()) {
-				newVersionInfo.files.push_back(static_cast<unsigned int>(fii.index));
-				fi->size = 0;
-				++numDeleted;
+	auto archivedPaths = f->GetRelativePaths();
+	for(uint32_t i = 0; i < archivedPaths.size(); ++i) {
+		auto *fi = f->GetByIndex(i);
+		if(fi->IsDirectory() || fi->size == 0 || archivedPaths.at(i).empty() || listedPaths.contains(get_path_key(archivedPaths.at(i))))
+			continue;
+		newVersionInfo.files.push_back(i);
+		fi->size = 0;
+		++numDeleted;
 #ifdef UVA_VERBOSE
-				std::cout << "Marked file '" << fi->name << "' for deletion!" << std::endl;
+		std::cout << "Marked file '" << fi->name << "' for deletion!" << std::endl;
 #endif
-			}
-		}
-		for(auto &child : fii.children)
-			fIterateHierarchy(*child, path);
-	};
-	fIterateHierarchy(root, "");
+	}
 
 	if(numAdded == 0 && numChanged == 0 && numDeleted == 0) {
+		FileManager::RemoveSystemFile(stagingPath.c_str());
 #ifdef UVA_VERBOSE
 		std::cout << "WARNING: Nothing to update!" << std::endl;
 #endif
@@ -300,6 +594,7 @@ pragma::uva::ArchiveFile::UpdateResult pragma::uva::ArchiveFile::PublishUpdate(c
 	std::cout << numAdded << " files have been added!" << std::endl;
 	std::cout << numChanged << " files have been changed!" << std::endl;
 	std::cout << numDeleted << " files have been deleted!" << std::endl;
+	std::cout << numShared << " files share the data of an existing file!" << std::endl;
 	//#endif
 	//for(unsigned int i=0;i<newVersionInfo.files.size();i++)
 	//	std::cout<<"FILE: "<<newVersionInfo.files[i]<<std::endl;
@@ -311,32 +606,36 @@ pragma::uva::ArchiveFile::UpdateResult pragma::uva::ArchiveFile::PublishUpdate(c
 		return UpdateResult::NothingToUpdate;
 	}*/
 	f->AddVersion(newVersionInfo);
-	if(f->Export() == false) {
+	auto stagingFile = NativeFile::Open(stagingPath);
+	auto exported = f->Export([&stagedPayloads, &stagingFile](uint32_t idx, FileInfo &fi, std::vector<uint8_t> &outData) -> bool {
+		auto it = stagedPayloads.find(idx);
+		if(it == stagedPayloads.end())
+			return false;
+		outData.resize(it->second.size);
+		if(stagingFile == nullptr || stagingFile->ReadAt(it->second.offset, outData.data(), outData.size()) == false) {
+			std::cout << "WARNING: Unable to read staged data for file '" << fi.name << "'!" << std::endl;
+			outData.clear();
+		}
+		return true;
+	}, options.exportMode);
+	stagingFile = nullptr;
+	FileManager::RemoveSystemFile(stagingPath.c_str());
+	if(exported == false) {
 #ifdef UVA_VERBOSE
 		std::cout << "WARNING: Unable to rename versioninfo_tmp.dat" << std::endl;
 #endif
 		return UpdateResult::UnableToRemoveTemporaryFiles;
 	}
+	auto t = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	std::cout << "Processed " << (numBytesRead / 1'000'000.0) << " MB in " << t << " s (" << ((t > 0.0) ? (numBytesRead / 1'000'000.0 / t) : 0.0) << " MB/s)" << std::endl;
 #ifdef UVA_VERBOSE
 	std::cout << "Publishing was successful! " << newVersionInfo.files.size() << " files have been updated." << std::endl;
 #endif
 	return UpdateResult::Success;
 }
 
-static void find_all_files(std::string path, const std::function<void(std::string, std::string)> &f)
-{
-	path = FileManager::GetCanonicalizedPath(path);
-	std::vector<std::string> files;
-	std::vector<std::string> dirs;
-	FileManager::FindSystemFiles((path + "/*").c_str(), &files, &dirs);
-	for(auto it = files.begin(); it != files.end(); ++it)
-		f(path + std::string("/"), *it);
-	for(auto it = dirs.begin(); it != dirs.end(); ++it)
-		find_all_files(path + std::string("/") + (*it), f);
-}
-
 pragma::uva::ArchiveFile::UpdateResult pragma::uva::ArchiveFile::PublishUpdate(util::Version &version, const std::string &updateListFile, const std::string &archiveFile, const std::function<bool(VFilePtr &)> &readCallback, const std::function<bool(VFilePtrReal &)> &writeCallback,
-  const std::function<void(std::string &, std::string &, std::vector<uint8_t> &)> &dataTranslateCallback)
+  const std::function<void(std::string &, std::string &, std::vector<uint8_t> &)> &dataTranslateCallback, const PublishOptions &options)
 {
 	auto flist = updateListFile;
 	std::string ext;
@@ -391,29 +690,39 @@ pragma::uva::ArchiveFile::UpdateResult pragma::uva::ArchiveFile::PublishUpdate(u
 			auto itSrc = keyvalues.find("src");
 			if(itSrc != keyvalues.end())
 				src = itSrc->second;
+			std::optional<Codec> codec {};
+			auto itCodec = keyvalues.find("codec");
+			if(itCodec != keyvalues.end()) {
+				codec = string_to_codec(itCodec->second);
+				if(codec.has_value() == false)
+					std::cout << "WARNING: Unknown codec '" << itCodec->second << "' for '" << argv.front() << "'!" << std::endl;
+			}
 			std::string sub;
 			if(f.length() > 3 && ((sub = f.substr(f.length() - 3)) == "/**" || sub == "\\**") && FileManager::IsSystemDir(f.substr(0, f.length() - 3)) == true) {
-				f = f.substr(0, f.length() - 3);
-				auto fLen = f.length();
-				find_all_files(f, [&fileInfo, &os, &src, &fLen](std::string path, std::string file) {
-					auto localPath = path.substr(fLen + 1, path.length());
-					if(!localPath.empty()) {
-						localPath = "/" + localPath;
-						if(localPath.back() == '/' || localPath.back() == '\\')
-							localPath = localPath.substr(0, localPath.length() - 1);
-					}
-					fileInfo.push_back(PublishInfo(FileManager::GetCanonicalizedPath(path + file), os, FileManager::GetCanonicalizedPath(src + localPath)));
-				});
+				f = FileManager::GetCanonicalizedPath(f.substr(0, f.length() - 3));
+				auto entries = walk_directory(f, options.numThreads);
+				fileInfo.reserve(fileInfo.size() + entries.size());
+				for(auto &entry : entries) {
+					std::string localPath;
+					auto sep = entry.path.find_last_of('/');
+					if(sep != std::string::npos)
+						localPath = "/" + entry.path.substr(0, sep);
+					fileInfo.push_back(PublishInfo(FileManager::GetCanonicalizedPath(f + '/' + entry.path), os, FileManager::GetCanonicalizedPath(src + localPath)));
+					fileInfo.back().codec = codec;
+					fileInfo.back().stat = entry.stat;
+				}
 			}
 			else {
 				std::vector<std::string> files;
 				FileManager::FindSystemFiles(f.c_str(), &files, nullptr, true);
-				for(auto it = files.begin(); it != files.end(); it++)
+				for(auto it = files.begin(); it != files.end(); it++) {
 					fileInfo.push_back(PublishInfo(ufile::get_path_from_filename(f) + *it, os, src));
+					fileInfo.back().codec = codec;
+				}
 			}
 		}
 	}
 	if(fileInfo.empty())
 		return UpdateResult::NothingToUpdate;
-	return PublishUpdate(pathToFiles, version, fileInfo, archiveFile, readCallback, writeCallback, dataTranslateCallback);
+	return PublishUpdate(pathToFiles, version, fileInfo, archiveFile, readCallback, writeCallback, dataTranslateCallback, options);
 }
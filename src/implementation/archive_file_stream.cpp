@@ -0,0 +1,164 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+module pragma.uva;
+
+#undef max
+
+// Decompressed bytes that a stream over a non-chunked file keeps around, also the size of its compressed read buffer
+static constexpr uint64_t STREAM_WINDOW_SIZE = 1024 * 1024;
+
+std::unique_ptr<pragma::uva::ArchiveFile::FileStream> pragma::uva::ArchiveFile::OpenFile(uint32_t idx) const
+{
+	LoadFileLayer();
+	if(idx >= m_files.size() || m_files.at(idx).IsFile() == false)
+		return nullptr;
+	return std::make_unique<FileStream>(*this, idx);
+}
+
+std::unique_ptr<pragma::uva::ArchiveFile::FileStream> pragma::uva::ArchiveFile::OpenFile(const std::string &fname) const
+{
+	uint32_t idx = 0;
+	if(FindFile(fname, idx) == nullptr)
+		return nullptr;
+	return OpenFile(idx);
+}
+
+pragma::uva::ArchiveFile::FileStream::FileStream(const ArchiveFile &archive, uint32_t idx) : m_archive {archive}, m_fileInfo {archive.m_files.at(idx)}
+{
+	if(auto cached = archive.m_dataCache.Peek(idx))
+		m_data = cached;
+}
+
+uint64_t pragma::uva::ArchiveFile::FileStream::GetSize() const { return m_fileInfo.sizeUncompressed; }
+uint64_t pragma::uva::ArchiveFile::FileStream::Tell() const { return m_position; }
+void pragma::uva::ArchiveFile::FileStream::Seek(uint64_t offset) { m_position = offset; }
+bool pragma::uva::ArchiveFile::FileStream::Eof() const { return m_position >= GetSize(); }
+const pragma::uva::FileInfo &pragma::uva::ArchiveFile::FileStream::GetFileInfo() const { return m_fileInfo; }
+
+uint64_t pragma::uva::ArchiveFile::FileStream::Read(void *data, uint64_t size)
+{
+	if(Eof())
+		return 0;
+	size = std::min(size, GetSize() - m_position);
+	auto *out = static_cast<uint8_t *>(data);
+	auto &fi = m_fileInfo;
+	if(m_data == nullptr && fi.IsSolid()) {
+		m_data = m_archive.GetSolidBlock(fi);
+		m_dataOffset = fi.blockOffset;
+		if(m_data == nullptr || fi.blockOffset > m_data->size() || fi.sizeUncompressed > m_data->size() - fi.blockOffset) {
+			m_data = nullptr;
+			return 0;
+		}
+	}
+	if(m_data != nullptr) {
+		std::copy_n(m_data->begin() + m_dataOffset + m_position, size, out);
+		m_position += size;
+		return size;
+	}
+	if(fi.IsChunked() == false && fi.GetCodec() == Codec::Store && fi.size == fi.sizeUncompressed) {
+		if(m_archive.ReadFileData(m_archive.m_inFileStartOffset, fi, m_position, std::span<uint8_t> {out, size}) == false)
+			return 0;
+		m_position += size;
+		return size;
+	}
+	// Reading the whole file at once doesn't need the window
+	if(m_position == 0 && size == GetSize() && fi.IsChunked() == false) {
+		if(m_archive.Decompress(fi, std::span<uint8_t> {out, size}) == false)
+			return 0;
+		m_position = size;
+		return size;
+	}
+
+	uint64_t numRead = 0;
+	while(numRead < size && FillWindow()) {
+		auto windowOffset = m_position - m_windowStart;
+		auto n = std::min(size - numRead, m_window.size() - windowOffset);
+		std::copy_n(m_window.begin() + windowOffset, n, out + numRead);
+		numRead += n;
+		m_position += n;
+	}
+	return numRead;
+}
+
+bool pragma::uva::ArchiveFile::FileStream::FillWindow()
+{
+	if(m_position >= m_windowStart && m_position - m_windowStart < m_window.size())
+		return true;
+	auto &fi = m_fileInfo;
+	if(fi.IsChunked()) {
+		if(m_chunkTable.has_value() == false) {
+			m_chunkTable = m_archive.ReadChunkTable(fi);
+			if(m_chunkTable.has_value() == false)
+				return false;
+		}
+		auto chunkIdx = static_cast<uint32_t>(m_position / m_chunkTable->chunkSize);
+		auto chunkInfo = m_archive.GetChunkInfo(fi, *m_chunkTable, chunkIdx);
+		m_window.resize(chunkInfo.sizeUncompressed);
+		m_windowStart = static_cast<uint64_t>(chunkIdx) * m_chunkTable->chunkSize;
+		if(m_archive.Decompress(chunkInfo, m_window) == false) {
+			m_window.clear();
+			return false;
+		}
+		return true;
+	}
+
+	if(m_decoder == nullptr || m_position < m_windowStart)
+		ResetDecoder();
+	if(m_decoder == nullptr)
+		return false;
+	while(m_position - m_windowStart >= m_window.size()) {
+		if(DecodeNextWindow() == false) {
+			// The decoder is in an undefined state, the next read starts over
+			m_decoder = nullptr;
+			m_window.clear();
+			m_windowStart = 0;
+			return false;
+		}
+	}
+	return true;
+}
+
+void pragma::uva::ArchiveFile::FileStream::ResetDecoder()
+{
+	auto &fi = m_fileInfo;
+	m_window.clear();
+	m_windowStart = 0;
+	m_decoder = is_codec_available(fi.GetCodec()) ? Decoder::Create(fi.GetCodec(), fi.sizeUncompressed) : nullptr;
+	m_in = m_archive.GetCompressedData(fi);
+	m_readOffset = m_in.size();
+	if(m_in.empty() && m_readBuffer.empty())
+		m_readBuffer.resize(std::min<uint64_t>(fi.size, STREAM_WINDOW_SIZE));
+}
+
+bool pragma::uva::ArchiveFile::FileStream::DecodeNextWindow()
+{
+	auto &fi = m_fileInfo;
+	m_windowStart += m_window.size();
+	if(m_windowStart >= fi.sizeUncompressed)
+		return false;
+	m_window.resize(std::min<uint64_t>(fi.sizeUncompressed - m_windowStart, STREAM_WINDOW_SIZE));
+	std::span<uint8_t> out = m_window;
+	while(out.empty() == false) {
+		if(m_in.empty() && m_readOffset < fi.size) {
+			auto n = std::min<uint64_t>(fi.size - m_readOffset, m_readBuffer.size());
+			if(m_archive.ReadFileData(m_archive.m_inFileStartOffset, fi, m_readOffset, std::span<uint8_t> {m_readBuffer.data(), n}) == false)
+				return false;
+			m_in = std::span<const uint8_t> {m_readBuffer.data(), n};
+			m_readOffset += n;
+		}
+		auto inSize = m_in.size();
+		auto outSize = out.size();
+		auto result = m_decoder->Decode(m_in, out);
+		if(result == Decoder::Result::Error)
+			return false;
+		if(result == Decoder::Result::Finished)
+			break;
+		if(m_in.size() == inSize && out.size() == outSize)
+			return false; // Truncated payload
+	}
+	// The payload has to decompress to exactly sizeUncompressed bytes
+	return out.empty();
+}
@@ -0,0 +1,106 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+module pragma.uva;
+
+import :checksum;
+
+static const std::array<uint32_t, 256> &get_crc32_table()
+{
+	static const auto table = []() {
+		std::array<uint32_t, 256> table {};
+		for(uint32_t i = 0; i < table.size(); ++i) {
+			auto c = i;
+			for(auto j = 0; j < 8; ++j)
+				c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+			table[i] = c;
+		}
+		return table;
+	}();
+	return table;
+}
+
+uint32_t pragma::uva::calc_crc32(std::span<const uint8_t> data)
+{
+	auto &table = get_crc32_table();
+	auto crc = 0xFFFFFFFFu;
+	for(auto b : data)
+		crc = table[(crc ^ b) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFFu;
+}
+
+static constexpr uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ull;
+static constexpr uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+static constexpr uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ull;
+
+template<typename T>
+static T read_le(const uint8_t *data)
+{
+	T value = 0;
+	for(auto i = sizeof(T); i > 0; --i)
+		value = (value << 8) | data[i - 1];
+	return value;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = std::rotl(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+static uint64_t xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t pragma::uva::calc_content_hash(std::span<const uint8_t> data)
+{
+	auto *p = data.data();
+	auto *end = p + data.size();
+	uint64_t h;
+	if(data.size() >= 32) {
+		uint64_t v1 = XXH_PRIME64_1 + XXH_PRIME64_2;
+		uint64_t v2 = XXH_PRIME64_2;
+		uint64_t v3 = 0;
+		uint64_t v4 = 0 - XXH_PRIME64_1;
+		for(; end - p >= 32; p += 32) {
+			v1 = xxh64_round(v1, read_le<uint64_t>(p));
+			v2 = xxh64_round(v2, read_le<uint64_t>(p + 8));
+			v3 = xxh64_round(v3, read_le<uint64_t>(p + 16));
+			v4 = xxh64_round(v4, read_le<uint64_t>(p + 24));
+		}
+		h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+		h = xxh64_merge_round(h, v1);
+		h = xxh64_merge_round(h, v2);
+		h = xxh64_merge_round(h, v3);
+		h = xxh64_merge_round(h, v4);
+	}
+	else
+		h = XXH_PRIME64_5;
+	h += data.size();
+	for(; end - p >= 8; p += 8) {
+		h ^= xxh64_round(0, read_le<uint64_t>(p));
+		h = std::rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+	if(end - p >= 4) {
+		h ^= read_le<uint32_t>(p) * XXH_PRIME64_1;
+		h = std::rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+	}
+	for(; p < end; ++p) {
+		h ^= *p * XXH_PRIME64_5;
+		h = std::rotl(h, 11) * XXH_PRIME64_1;
+	}
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
@@ -0,0 +1,15 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+export module pragma.uva:checksum;
+
+export import std.compat;
+
+export namespace pragma::uva {
+	// CRC-32 (IEEE) of the uncompressed file data, as stored in FileInfo::crc
+	uint32_t calc_crc32(std::span<const uint8_t> data);
+	// XXH64 (seed 0), as stored in FileInfo::contentHash. Used to detect unchanged and duplicate files.
+	uint64_t calc_content_hash(std::span<const uint8_t> data);
+};
@@ -0,0 +1,363 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "bzlib_wrapper.hpp"
+#ifdef UVA_ENABLE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef UVA_ENABLE_LZ4
+#include <lz4frame.h>
+#endif
+
+module pragma.uva;
+
+import :codec;
+
+// bzip2 and lz4 take 32-bit sizes, larger buffers are passed in chunks
+static constexpr uint64_t MAX_CHUNK_SIZE = std::numeric_limits<unsigned int>::max();
+
+std::string pragma::uva::codec_to_string(Codec codec)
+{
+	switch(codec) {
+	case Codec::Bzip2:
+		return "bzip2";
+	case Codec::Store:
+		return "store";
+	case Codec::Zstd:
+		return "zstd";
+	case Codec::Lz4:
+		return "lz4";
+	default:
+		return "unknown";
+	}
+}
+
+std::optional<pragma::uva::Codec> pragma::uva::string_to_codec(const std::string &str)
+{
+	for(auto i = std::underlying_type_t<Codec> {0}; i < static_cast<std::underlying_type_t<Codec>>(Codec::Count); ++i) {
+		if(ustring::compare(str, codec_to_string(static_cast<Codec>(i)), false))
+			return static_cast<Codec>(i);
+	}
+	return {};
+}
+
+bool pragma::uva::is_codec_available(Codec codec)
+{
+	switch(codec) {
+	case Codec::Bzip2:
+	case Codec::Store:
+		return true;
+#ifdef UVA_ENABLE_ZSTD
+	case Codec::Zstd:
+		return true;
+#endif
+#ifdef UVA_ENABLE_LZ4
+	case Codec::Lz4:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+static bool compress_bzip2(std::span<const uint8_t> src, std::vector<uint8_t> &dst)
+{
+	int32_t blockSize100k = 8;
+	int32_t verbosity = 0;
+	int32_t workFactor = 30;
+	bz_stream stream {};
+	if(BZ2_bzCompressInit(&stream, blockSize100k, verbosity, workFactor) != BZ_OK)
+		return false;
+	dst.resize(src.size() + src.size() / 100 + 600);
+	uint64_t inPos = 0;
+	uint64_t outPos = 0;
+	int32_t err = BZ_OK;
+	do {
+		if(outPos == dst.size())
+			dst.resize(dst.size() * 2);
+		auto szIn = std::min(src.size() - inPos, MAX_CHUNK_SIZE);
+		auto szOut = std::min(dst.size() - outPos, MAX_CHUNK_SIZE);
+		stream.next_in = reinterpret_cast<char *>(const_cast<uint8_t *>(src.data() + inPos));
+		stream.avail_in = static_cast<unsigned int>(szIn);
+		stream.next_out = reinterpret_cast<char *>(dst.data() + outPos);
+		stream.avail_out = static_cast<unsigned int>(szOut);
+		err = BZ2_bzCompress(&stream, (inPos + szIn == src.size()) ? BZ_FINISH : BZ_RUN);
+		inPos += szIn - stream.avail_in;
+		outPos += szOut - stream.avail_out;
+	} while(err == BZ_RUN_OK || err == BZ_FINISH_OK);
+	BZ2_bzCompressEnd(&stream);
+	dst.resize(outPos);
+	return err == BZ_STREAM_END;
+}
+
+static bool decompress_bzip2(std::span<const uint8_t> src, std::span<uint8_t> dst)
+{
+	int32_t small = 0;
+	int32_t verbosity = 0;
+	bz_stream stream {};
+	if(BZ2_bzDecompressInit(&stream, verbosity, small) != BZ_OK)
+		return false;
+	uint64_t inPos = 0;
+	uint64_t outPos = 0;
+	int32_t err = BZ_OK;
+	do {
+		auto szIn = std::min(src.size() - inPos, MAX_CHUNK_SIZE);
+		auto szOut = std::min(dst.size() - outPos, MAX_CHUNK_SIZE);
+		// bzip2 does not modify the source buffer, it just isn't declared const
+		stream.next_in = reinterpret_cast<char *>(const_cast<uint8_t *>(src.data() + inPos));
+		stream.avail_in = static_cast<unsigned int>(szIn);
+		stream.next_out = reinterpret_cast<char *>(dst.data() + outPos);
+		stream.avail_out = static_cast<unsigned int>(szOut);
+		err = BZ2_bzDecompress(&stream);
+		inPos += szIn - stream.avail_in;
+		outPos += szOut - stream.avail_out;
+		if(err == BZ_OK && szIn - stream.avail_in == 0 && szOut - stream.avail_out == 0)
+			break; // No progress, either the input is truncated or the output buffer is too small
+	} while(err == BZ_OK);
+	BZ2_bzDecompressEnd(&stream);
+	return err == BZ_STREAM_END && outPos == dst.size();
+}
+
+#ifdef UVA_ENABLE_ZSTD
+static bool compress_zstd(std::span<const uint8_t> src, std::vector<uint8_t> &dst)
+{
+	constexpr int32_t compressionLevel = 9;
+	dst.resize(ZSTD_compressBound(src.size()));
+	auto size = ZSTD_compress(dst.data(), dst.size(), src.data(), src.size(), compressionLevel);
+	if(ZSTD_isError(size))
+		return false;
+	dst.resize(size);
+	return true;
+}
+
+static bool decompress_zstd(std::span<const uint8_t> src, std::span<uint8_t> dst)
+{
+	auto size = ZSTD_decompress(dst.data(), dst.size(), src.data(), src.size());
+	return ZSTD_isError(size) == false && size == dst.size();
+}
+#endif
+
+#ifdef UVA_ENABLE_LZ4
+// The frame format is used rather than raw blocks, since blocks are limited to 2 GiB
+static bool compress_lz4(std::span<const uint8_t> src, std::vector<uint8_t> &dst)
+{
+	LZ4F_preferences_t prefs {};
+	prefs.frameInfo.contentSize = src.size();
+	dst.resize(LZ4F_compressFrameBound(src.size(), &prefs));
+	auto size = LZ4F_compressFrame(dst.data(), dst.size(), src.data(), src.size(), &prefs);
+	if(LZ4F_isError(size))
+		return false;
+	dst.resize(size);
+	return true;
+}
+
+static bool decompress_lz4(std::span<const uint8_t> src, std::span<uint8_t> dst)
+{
+	LZ4F_dctx *ctx = nullptr;
+	if(LZ4F_isError(LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION)))
+		return false;
+	uint64_t inPos = 0;
+	uint64_t outPos = 0;
+	size_t hint = 1;
+	while(hint != 0 && inPos < src.size()) {
+		size_t szIn = src.size() - inPos;
+		size_t szOut = dst.size() - outPos;
+		hint = LZ4F_decompress(ctx, dst.data() + outPos, &szOut, src.data() + inPos, &szIn, nullptr);
+		if(LZ4F_isError(hint) || (szIn == 0 && szOut == 0))
+			break;
+		inPos += szIn;
+		outPos += szOut;
+	}
+	LZ4F_freeDecompressionContext(ctx);
+	return hint == 0 && outPos == dst.size();
+}
+#endif
+
+bool pragma::uva::compress_chunked(Codec codec, std::span<const uint8_t> src, uint32_t chunkSize, std::vector<uint8_t> &dst)
+{
+	if(chunkSize == 0)
+		return false;
+	auto numChunks = (src.size() + chunkSize - 1) / chunkSize;
+	if(numChunks > std::numeric_limits<uint32_t>::max())
+		return false;
+	ChunkTableHeader header {chunkSize, static_cast<uint32_t>(numChunks)};
+	auto tableSize = sizeof(header) + numChunks * sizeof(uint64_t);
+	dst.resize(tableSize);
+	std::memcpy(dst.data(), &header, sizeof(header));
+	std::vector<uint8_t> chunk;
+	for(uint64_t i = 0; i < numChunks; ++i) {
+		auto offset = i * chunkSize;
+		if(compress(codec, src.subspan(offset, std::min<uint64_t>(chunkSize, src.size() - offset)), chunk) == false)
+			return false;
+		dst.insert(dst.end(), chunk.begin(), chunk.end());
+		uint64_t end = dst.size() - tableSize;
+		std::memcpy(dst.data() + sizeof(header) + i * sizeof(uint64_t), &end, sizeof(end));
+	}
+	return true;
+}
+
+bool pragma::uva::compress(Codec codec, std::span<const uint8_t> src, std::vector<uint8_t> &dst)
+{
+	switch(codec) {
+	case Codec::Bzip2:
+		return compress_bzip2(src, dst);
+	case Codec::Store:
+		dst.assign(src.begin(), src.end());
+		return true;
+#ifdef UVA_ENABLE_ZSTD
+	case Codec::Zstd:
+		return compress_zstd(src, dst);
+#endif
+#ifdef UVA_ENABLE_LZ4
+	case Codec::Lz4:
+		return compress_lz4(src, dst);
+#endif
+	default:
+		return false;
+	}
+}
+
+bool pragma::uva::decompress(Codec codec, std::span<const uint8_t> src, std::span<uint8_t> dst)
+{
+	switch(codec) {
+	case Codec::Bzip2:
+		return decompress_bzip2(src, dst);
+	case Codec::Store:
+		if(src.size() != dst.size())
+			return false;
+		std::memcpy(dst.data(), src.data(), src.size());
+		return true;
+#ifdef UVA_ENABLE_ZSTD
+	case Codec::Zstd:
+		return decompress_zstd(src, dst);
+#endif
+#ifdef UVA_ENABLE_LZ4
+	case Codec::Lz4:
+		return decompress_lz4(src, dst);
+#endif
+	default:
+		return false;
+	}
+}
+
+class StoreDecoder : public pragma::uva::Decoder {
+  public:
+	StoreDecoder(uint64_t size) : m_remaining {size} {}
+	virtual Result Decode(std::span<const uint8_t> &in, std::span<uint8_t> &out) override
+	{
+		auto n = std::min<uint64_t>({in.size(), out.size(), m_remaining});
+		std::memcpy(out.data(), in.data(), n);
+		in = in.subspan(n);
+		out = out.subspan(n);
+		m_remaining -= n;
+		return (m_remaining == 0) ? Result::Finished : Result::Continue;
+	}
+  private:
+	uint64_t m_remaining = 0;
+};
+
+class Bzip2Decoder : public pragma::uva::Decoder {
+  public:
+	Bzip2Decoder() { m_initialized = (BZ2_bzDecompressInit(&m_stream, 0 /* verbosity */, 0 /* small */) == BZ_OK); }
+	virtual ~Bzip2Decoder() override
+	{
+		if(m_initialized)
+			BZ2_bzDecompressEnd(&m_stream);
+	}
+	virtual Result Decode(std::span<const uint8_t> &in, std::span<uint8_t> &out) override
+	{
+		if(m_initialized == false)
+			return Result::Error;
+		auto szIn = std::min<uint64_t>(in.size(), MAX_CHUNK_SIZE);
+		auto szOut = std::min<uint64_t>(out.size(), MAX_CHUNK_SIZE);
+		m_stream.next_in = reinterpret_cast<char *>(const_cast<uint8_t *>(in.data()));
+		m_stream.avail_in = static_cast<unsigned int>(szIn);
+		m_stream.next_out = reinterpret_cast<char *>(out.data());
+		m_stream.avail_out = static_cast<unsigned int>(szOut);
+		auto err = BZ2_bzDecompress(&m_stream);
+		in = in.subspan(szIn - m_stream.avail_in);
+		out = out.subspan(szOut - m_stream.avail_out);
+		if(err == BZ_STREAM_END)
+			return Result::Finished;
+		return (err == BZ_OK) ? Result::Continue : Result::Error;
+	}
+  private:
+	bz_stream m_stream {};
+	bool m_initialized = false;
+};
+
+#ifdef UVA_ENABLE_ZSTD
+class ZstdDecoder : public pragma::uva::Decoder {
+  public:
+	ZstdDecoder() : m_ctx {ZSTD_createDCtx()} {}
+	virtual ~ZstdDecoder() override { ZSTD_freeDCtx(m_ctx); }
+	virtual Result Decode(std::span<const uint8_t> &in, std::span<uint8_t> &out) override
+	{
+		if(m_ctx == nullptr)
+			return Result::Error;
+		ZSTD_inBuffer inBuf {in.data(), in.size(), 0};
+		ZSTD_outBuffer outBuf {out.data(), out.size(), 0};
+		auto ret = ZSTD_decompressStream(m_ctx, &outBuf, &inBuf);
+		in = in.subspan(inBuf.pos);
+		out = out.subspan(outBuf.pos);
+		if(ZSTD_isError(ret))
+			return Result::Error;
+		return (ret == 0) ? Result::Finished : Result::Continue;
+	}
+  private:
+	ZSTD_DCtx *m_ctx = nullptr;
+};
+#endif
+
+#ifdef UVA_ENABLE_LZ4
+class Lz4Decoder : public pragma::uva::Decoder {
+  public:
+	Lz4Decoder()
+	{
+		if(LZ4F_isError(LZ4F_createDecompressionContext(&m_ctx, LZ4F_VERSION)))
+			m_ctx = nullptr;
+	}
+	virtual ~Lz4Decoder() override
+	{
+		if(m_ctx != nullptr)
+			LZ4F_freeDecompressionContext(m_ctx);
+	}
+	virtual Result Decode(std::span<const uint8_t> &in, std::span<uint8_t> &out) override
+	{
+		if(m_ctx == nullptr)
+			return Result::Error;
+		size_t szIn = in.size();
+		size_t szOut = out.size();
+		auto hint = LZ4F_decompress(m_ctx, out.data(), &szOut, in.data(), &szIn, nullptr);
+		in = in.subspan(szIn);
+		out = out.subspan(szOut);
+		if(LZ4F_isError(hint))
+			return Result::Error;
+		return (hint == 0) ? Result::Finished : Result::Continue;
+	}
+  private:
+	LZ4F_dctx *m_ctx = nullptr;
+};
+#endif
+
+std::unique_ptr<pragma::uva::Decoder> pragma::uva::Decoder::Create(Codec codec, uint64_t sizeUncompressed)
+{
+	switch(codec) {
+	case Codec::Bzip2:
+		return std::make_unique<Bzip2Decoder>();
+	case Codec::Store:
+		return std::make_unique<StoreDecoder>(sizeUncompressed);
+#ifdef UVA_ENABLE_ZSTD
+	case Codec::Zstd:
+		return std::make_unique<ZstdDecoder>();
+#endif
+#ifdef UVA_ENABLE_LZ4
+	case Codec::Lz4:
+		return std::make_unique<Lz4Decoder>();
+#endif
+	default:
+		return nullptr;
+	}
+}
@@ -0,0 +1,41 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+export module pragma.uva:codec;
+
+export import std.compat;
+
+export namespace pragma::uva {
+	// Compression codec of a file payload. Bzip2 has to stay 0, archives prior to version 2 don't store a codec.
+	enum class Codec : uint8_t { Bzip2 = 0, Store, Zstd, Lz4, Count };
+
+	std::string codec_to_string(Codec codec);
+	std::optional<Codec> string_to_codec(const std::string &str);
+	// Store and bzip2 are always available, zstd and lz4 depend on UVA_ENABLE_ZSTD / UVA_ENABLE_LZ4
+	bool is_codec_available(Codec codec);
+	bool compress(Codec codec, std::span<const uint8_t> src, std::vector<uint8_t> &dst);
+	// Fails unless exactly dst.size() bytes were decompressed
+	bool decompress(Codec codec, std::span<const uint8_t> src, std::span<uint8_t> dst);
+
+	// Chunked payloads consist of a ChunkTableHeader, the end offsets of all chunks (uint64_t, relative to the end of
+	// the table) and the chunks themselves. Every chunk decompresses to chunkSize bytes, except for the last one, and
+	// can be decompressed on its own.
+	struct ChunkTableHeader {
+		uint32_t chunkSize = 0;
+		uint32_t numChunks = 0;
+	};
+	bool compress_chunked(Codec codec, std::span<const uint8_t> src, uint32_t chunkSize, std::vector<uint8_t> &dst);
+
+	// Incremental decompression with a fixed amount of working memory, regardless of the payload size
+	class Decoder {
+	  public:
+		enum class Result : uint8_t { Continue = 0, Finished, Error };
+		// Returns nullptr if the codec is not available
+		static std::unique_ptr<Decoder> Create(Codec codec, uint64_t sizeUncompressed);
+		virtual ~Decoder() = default;
+		// Consumes input from the front of 'in' and writes output to the front of 'out', both spans are advanced accordingly
+		virtual Result Decode(std::span<const uint8_t> &in, std::span<uint8_t> &out) = 0;
+	};
+};
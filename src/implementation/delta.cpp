@@ -0,0 +1,175 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+module pragma.uva;
+
+import :checksum;
+import :delta;
+
+// Layout: DeltaHeader, followed by instructions until the target is complete. Each instruction starts with an
+// opcode byte; Insert is followed by a varint length and the literal bytes, Copy by the zigzag varint distance of the
+// source offset to the end of the previous copy and a varint length.
+static constexpr std::array<char, 4> DELTA_IDENT = {'U', 'V', 'D', 'L'};
+enum class DeltaOp : uint8_t { Insert = 0, Copy };
+#pragma pack(push, 1)
+struct DeltaHeader {
+	std::array<char, 4> ident = DELTA_IDENT;
+	uint64_t baseSize = 0;
+	uint64_t baseHash = 0;
+	uint64_t targetSize = 0;
+	uint64_t targetHash = 0;
+	uint8_t targetCodec = 0;
+};
+#pragma pack(pop)
+
+// Matches shorter than this aren't worth a copy instruction
+static constexpr size_t DELTA_BLOCK_SIZE = 16;
+
+static uint64_t hash_delta_block(const uint8_t *data)
+{
+	uint64_t a, b;
+	std::memcpy(&a, data, sizeof(a));
+	std::memcpy(&b, data + sizeof(a), sizeof(b));
+	return (a * 0x9E3779B185EBCA87ull) ^ std::rotl(b * 0xC2B2AE3D27D4EB4Full, 31);
+}
+
+static void write_varint(std::vector<uint8_t> &out, uint64_t value)
+{
+	while(value >= 0x80) {
+		out.push_back(static_cast<uint8_t>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+static bool read_varint(std::span<const uint8_t> data, size_t &pos, uint64_t &value)
+{
+	value = 0;
+	for(uint32_t shift = 0; shift < 64; shift += 7) {
+		if(pos >= data.size())
+			return false;
+		auto b = data[pos++];
+		value |= static_cast<uint64_t>(b & 0x7F) << shift;
+		if((b & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+void pragma::uva::create_delta(std::span<const uint8_t> base, std::span<const uint8_t> target, Codec targetCodec, std::vector<uint8_t> &delta)
+{
+	DeltaHeader header {};
+	header.baseSize = base.size();
+	header.baseHash = calc_content_hash(base);
+	header.targetSize = target.size();
+	header.targetHash = calc_content_hash(target);
+	header.targetCodec = static_cast<uint8_t>(targetCodec);
+	delta.clear();
+	delta.resize(sizeof(header));
+	std::memcpy(delta.data(), &header, sizeof(header));
+
+	// Lossy hash table over the base blocks at block-aligned offsets, any match of at least twice the block size is
+	// guaranteed to contain one of them. Offsets are stored +1, 0 marks an empty slot.
+	std::vector<uint64_t> table;
+	uint32_t tableShift = 64;
+	if(base.size() >= DELTA_BLOCK_SIZE) {
+		auto numBlocks = base.size() / DELTA_BLOCK_SIZE;
+		auto tableSize = std::bit_ceil(numBlocks * 2);
+		tableShift = 64 - std::countr_zero(tableSize);
+		table.resize(tableSize, 0);
+		for(size_t offset = 0; offset + DELTA_BLOCK_SIZE <= base.size(); offset += DELTA_BLOCK_SIZE) {
+			auto &slot = table[hash_delta_block(base.data() + offset) >> tableShift];
+			if(slot == 0)
+				slot = offset + 1;
+		}
+	}
+
+	uint64_t lastCopyEnd = 0;
+	size_t insertStart = 0;
+	auto fFlushInsert = [&](size_t end) {
+		if(end == insertStart)
+			return;
+		delta.push_back(static_cast<uint8_t>(DeltaOp::Insert));
+		write_varint(delta, end - insertStart);
+		delta.insert(delta.end(), target.begin() + insertStart, target.begin() + end);
+	};
+	auto fMatches = [&](uint64_t baseOffset, size_t pos) { return baseOffset + DELTA_BLOCK_SIZE <= base.size() && std::memcmp(base.data() + baseOffset, target.data() + pos, DELTA_BLOCK_SIZE) == 0; };
+	size_t pos = 0;
+	while(table.empty() == false && pos + DELTA_BLOCK_SIZE <= target.size()) {
+		// Edits usually leave the data that follows in place, so continuing the previous copy is tried first
+		auto baseOffset = lastCopyEnd + (pos - insertStart);
+		if(fMatches(baseOffset, pos) == false) {
+			auto slot = table[hash_delta_block(target.data() + pos) >> tableShift];
+			if(slot == 0 || fMatches(slot - 1, pos) == false) {
+				++pos;
+				continue;
+			}
+			baseOffset = slot - 1;
+		}
+		auto len = DELTA_BLOCK_SIZE;
+		while(baseOffset + len < base.size() && pos + len < target.size() && base[baseOffset + len] == target[pos + len])
+			++len;
+		while(pos > insertStart && baseOffset > 0 && base[baseOffset - 1] == target[pos - 1]) {
+			--pos;
+			--baseOffset;
+			++len;
+		}
+		fFlushInsert(pos);
+		delta.push_back(static_cast<uint8_t>(DeltaOp::Copy));
+		auto distance = static_cast<int64_t>(baseOffset - lastCopyEnd);
+		write_varint(delta, (static_cast<uint64_t>(distance) << 1) ^ static_cast<uint64_t>(distance >> 63));
+		write_varint(delta, len);
+		pos += len;
+		lastCopyEnd = baseOffset + len;
+		insertStart = pos;
+	}
+	fFlushInsert(target.size());
+}
+
+bool pragma::uva::apply_delta(std::span<const uint8_t> base, std::span<const uint8_t> delta, std::vector<uint8_t> &target, Codec &targetCodec)
+{
+	DeltaHeader header {};
+	if(delta.size() < sizeof(header))
+		return false;
+	std::memcpy(&header, delta.data(), sizeof(header));
+	if(header.ident != DELTA_IDENT || header.baseSize != base.size() || header.targetCodec >= static_cast<uint8_t>(Codec::Count) || header.baseHash != calc_content_hash(base))
+		return false;
+	target.clear();
+	target.reserve(header.targetSize);
+	uint64_t lastCopyEnd = 0;
+	size_t pos = sizeof(header);
+	while(pos < delta.size()) {
+		auto op = static_cast<DeltaOp>(delta[pos++]);
+		uint64_t len = 0;
+		switch(op) {
+		case DeltaOp::Insert:
+			{
+				if(read_varint(delta, pos, len) == false || len > delta.size() - pos || len > header.targetSize - target.size())
+					return false;
+				target.insert(target.end(), delta.begin() + pos, delta.begin() + pos + len);
+				pos += len;
+				break;
+			}
+		case DeltaOp::Copy:
+			{
+				uint64_t zigzag = 0;
+				if(read_varint(delta, pos, zigzag) == false || read_varint(delta, pos, len) == false)
+					return false;
+				auto offset = lastCopyEnd + ((zigzag >> 1) ^ (0 - (zigzag & 1)));
+				if(offset > base.size() || len > base.size() - offset || len > header.targetSize - target.size())
+					return false;
+				target.insert(target.end(), base.begin() + offset, base.begin() + offset + len);
+				lastCopyEnd = offset + len;
+				break;
+			}
+		default:
+			return false;
+		}
+	}
+	if(target.size() != header.targetSize || calc_content_hash(target) != header.targetHash)
+		return false;
+	targetCodec = static_cast<Codec>(header.targetCodec);
+	return true;
+}
@@ -0,0 +1,18 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+export module pragma.uva:delta;
+
+export import std.compat;
+import :codec;
+
+export namespace pragma::uva {
+	// Binary delta that rebuilds 'target' from 'base' out of copies of base ranges and inserted literal bytes.
+	// The delta is uncompressed, the literals and instructions are meant to be compressed with a regular codec afterwards.
+	// targetCodec is recorded in the delta, so the rebuilt file can be stored the same way as the original.
+	void create_delta(std::span<const uint8_t> base, std::span<const uint8_t> target, Codec targetCodec, std::vector<uint8_t> &delta);
+	// Fails if 'base' is not the data the delta was created against, or if the result doesn't match the original target
+	bool apply_delta(std::span<const uint8_t> base, std::span<const uint8_t> delta, std::vector<uint8_t> &target, Codec &targetCodec);
+};
@@ -0,0 +1,153 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+module pragma.uva;
+
+import :directory_walker;
+import :thread_pool;
+
+namespace {
+	struct DirectoryNode {
+		// Relative to the root of the walk, empty for the root itself
+		std::string path;
+		std::vector<pragma::uva::DirectoryEntry> files;
+		std::vector<std::unique_ptr<DirectoryNode>> subDirectories;
+	};
+};
+
+#ifdef _WIN32
+// FILETIME counts 100 ns intervals since 1601. Scaling that to nanoseconds directly would overflow 64 bits, the result
+// is relative to the Unix epoch instead (like the mtime on other platforms).
+static int64_t filetime_to_ns(const FILETIME &ft)
+{
+	constexpr int64_t UNIX_EPOCH_TICKS = 116'444'736'000'000'000;
+	auto ticks = static_cast<int64_t>((static_cast<uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime);
+	return (ticks - UNIX_EPOCH_TICKS) * 100;
+}
+#endif
+
+static void list_directory(const std::string &root, DirectoryNode &node, pragma::uva::ThreadPool &pool)
+{
+	auto absPath = node.path.empty() ? root : (root + '/' + node.path);
+	auto prefix = node.path.empty() ? std::string {} : (node.path + '/');
+	std::vector<std::string> dirNames;
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	auto h = FindFirstFileExA((absPath + "\\*").c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+	if(h != INVALID_HANDLE_VALUE) {
+		do {
+			std::string_view name = data.cFileName;
+			if(name == "." || name == "..")
+				continue;
+			if((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+				if((data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0)
+					dirNames.push_back(std::string {name});
+				continue;
+			}
+			// The listing already contains the size and modification time, no additional query required
+			pragma::uva::FileStat stat {};
+			stat.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+			stat.mtime = filetime_to_ns(data.ftLastWriteTime);
+			node.files.push_back({prefix + std::string {name}, stat});
+		} while(FindNextFileA(h, &data) != FALSE);
+		FindClose(h);
+	}
+#else
+	auto *dir = opendir(absPath.c_str());
+	if(dir != nullptr) {
+		auto fd = dirfd(dir);
+		while(auto *entry = readdir(dir)) {
+			std::string_view name = entry->d_name;
+			if(name == "." || name == "..")
+				continue;
+			if(entry->d_type == DT_DIR) {
+				dirNames.push_back(std::string {name});
+				continue;
+			}
+			if(entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN)
+				continue;
+			// Symbolic links are resolved, but only links to files are taken into account
+			struct stat st;
+			if(fstatat(fd, entry->d_name, &st, 0) != 0)
+				continue;
+			if(S_ISDIR(st.st_mode)) {
+				if(entry->d_type == DT_UNKNOWN)
+					dirNames.push_back(std::string {name});
+				continue;
+			}
+			if(S_ISREG(st.st_mode) == false)
+				continue;
+			pragma::uva::FileStat stat {};
+			stat.size = static_cast<uint64_t>(st.st_size);
+			stat.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+			stat.inode = static_cast<uint64_t>(st.st_ino);
+			node.files.push_back({prefix + std::string {name}, stat});
+		}
+		closedir(dir);
+	}
+#endif
+	std::sort(node.files.begin(), node.files.end(), [](const pragma::uva::DirectoryEntry &a, const pragma::uva::DirectoryEntry &b) { return a.path < b.path; });
+	std::sort(dirNames.begin(), dirNames.end());
+	node.subDirectories.reserve(dirNames.size());
+	for(auto &name : dirNames) {
+		auto subDir = std::make_unique<DirectoryNode>();
+		subDir->path = prefix + name;
+		auto *pSubDir = subDir.get();
+		node.subDirectories.push_back(std::move(subDir));
+		pool.Submit([&root, pSubDir, &pool]() { list_directory(root, *pSubDir, pool); });
+	}
+}
+
+static void collect_files(DirectoryNode &node, std::vector<pragma::uva::DirectoryEntry> &outFiles)
+{
+	std::move(node.files.begin(), node.files.end(), std::back_inserter(outFiles));
+	for(auto &subDir : node.subDirectories)
+		collect_files(*subDir, outFiles);
+}
+
+std::vector<pragma::uva::DirectoryEntry> pragma::uva::walk_directory(const std::string &root, uint32_t numThreads)
+{
+	auto normalizedRoot = root;
+	while(normalizedRoot.size() > 1 && (normalizedRoot.back() == '/' || normalizedRoot.back() == '\\'))
+		normalizedRoot.pop_back();
+	DirectoryNode rootNode {};
+	{
+		ThreadPool pool {numThreads};
+		pool.Submit([&normalizedRoot, &rootNode, &pool]() { list_directory(normalizedRoot, rootNode, pool); });
+		pool.Wait();
+	}
+	std::vector<DirectoryEntry> files;
+	collect_files(rootNode, files);
+	return files;
+}
+
+bool pragma::uva::get_file_stat(const std::string &path, FileStat &outStat)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if(GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data) == FALSE || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+		return false;
+	outStat = {};
+	outStat.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+	outStat.mtime = filetime_to_ns(data.ftLastWriteTime);
+#else
+	struct stat st;
+	if(stat(path.c_str(), &st) != 0 || S_ISREG(st.st_mode) == false)
+		return false;
+	outStat = {};
+	outStat.size = static_cast<uint64_t>(st.st_size);
+	outStat.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+	outStat.inode = static_cast<uint64_t>(st.st_ino);
+#endif
+	return true;
+}
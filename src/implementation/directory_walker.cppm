@@ -0,0 +1,30 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+export module pragma.uva:directory_walker;
+
+export import std.compat;
+
+export namespace pragma::uva {
+	// File metadata captured while enumerating a directory, so later stages don't have to query it again
+	struct FileStat {
+		uint64_t size = 0;
+		// Last modification time in nanoseconds since the Unix epoch
+		int64_t mtime = 0;
+		// 0 if the platform doesn't provide it
+		uint64_t inode = 0;
+	};
+	struct DirectoryEntry {
+		// Relative to the root of the walk, '/' as separator
+		std::string path;
+		FileStat stat;
+	};
+	// Enumerates all files below 'root', every directory is listed by a task of its own on a pool of numThreads threads
+	// (0 = one per hardware thread). The files of a directory precede those of its subdirectories, both sorted by name.
+	// Symbolic links to directories are not followed.
+	std::vector<DirectoryEntry> walk_directory(const std::string &root, uint32_t numThreads = 0);
+	// Same metadata as walk_directory provides, for a single file. Returns false if it doesn't exist or isn't a regular file.
+	bool get_file_stat(const std::string &path, FileStat &outStat);
+};
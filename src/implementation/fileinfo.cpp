@@ -30,7 +30,15 @@ pragma::uva::FileInfo::Flags pragma::uva::FileInfo::os_to_flags(P_OS os)
 }
 bool pragma::uva::FileInfo::IsDirectory() const { return (flags & Flags::Directory) != Flags::None; }
 bool pragma::uva::FileInfo::IsFile() const { return !IsDirectory(); }
-bool pragma::uva::FileInfo::IsCompressed() const { return true; }
+bool pragma::uva::FileInfo::IsCompressed() const { return GetCodec() != Codec::Store; }
+bool pragma::uva::FileInfo::IsSolid() const { return (flags & Flags::Solid) != Flags::None; }
+bool pragma::uva::FileInfo::IsChunked() const { return (flags & Flags::Chunked) != Flags::None; }
+pragma::uva::Codec pragma::uva::FileInfo::GetCodec() const { return static_cast<Codec>((umath::to_integral(flags) & umath::to_integral(Flags::CodecMask)) >> CODEC_SHIFT); }
+void pragma::uva::FileInfo::SetCodec(Codec codec)
+{
+	flags &= ~Flags::CodecMask;
+	flags |= static_cast<Flags>((static_cast<uint32_t>(codec) << CODEC_SHIFT) & umath::to_integral(Flags::CodecMask));
+}
 bool pragma::uva::FileInfo::operator==(P_OS os) const
 {
 	auto osFlags = flags & Flags::AllOS;
@@ -60,7 +68,9 @@ bool pragma::uva::PublishInfo::operator==(const P_OS &os) const { return (this->
 bool pragma::uva::PublishInfo::operator!=(const P_OS &os) const { return (*this == os) ? false : true; }
 bool pragma::uva::PublishInfo::operator==(const pragma::uva::FileInfo &info) const
 {
-	if(pragma::uva::FileInfo::os_to_flags(os) != info.flags)
+	// The flags that describe how the payload is stored don't concern the source file
+	auto layoutFlags = pragma::uva::FileInfo::Flags::CodecMask | pragma::uva::FileInfo::Flags::Solid | pragma::uva::FileInfo::Flags::Chunked | pragma::uva::FileInfo::Flags::Delta;
+	if(pragma::uva::FileInfo::os_to_flags(os) != (info.flags & ~layoutFlags))
 		return false;
 	std::string name = GetSourceName();
 	return (name == info.name) ? true : false;
@@ -8,26 +8,47 @@ module;
 
 export module pragma.uva:fileinfo;
 
+import :codec;
+import :directory_walker;
 import :os_info;
 import pragma.math;
 
 export namespace pragma::uva {
 	struct DLLUVA FileInfo {
-		enum class Flags : uint32_t { None = 0, Directory = 1, Windows = Directory << 1, Linux = Windows << 1, x86 = Linux << 1, x64 = x86 << 1, AllOS = Windows | Linux | x86 | x64 };
+		// The codec is stored in the CodecMask bits. Delta is only used in patch archives (see ArchiveFile::CreatePatch),
+		// the payload of such a file is a delta against the previous version of the file. Solid files are stored in a
+		// block shared with other files (see PublishOptions::solidBlockSize), chunked files as independently compressed
+		// chunks (see PublishOptions::chunkSize and ChunkTableHeader).
+		enum class Flags : uint32_t { None = 0, Directory = 1, Windows = Directory << 1, Linux = Windows << 1, x86 = Linux << 1, x64 = x86 << 1, AllOS = Windows | Linux | x86 | x64, Delta = x64 << 1, Solid = Delta << 1, Chunked = Solid << 1, CodecMask = 0xF00u };
+		static constexpr uint32_t CODEC_SHIFT = 8;
 		static Flags os_to_flags(P_OS os);
 
 		FileInfo() = default;
-		std::string name;
+		// Points into the name pool of the owning archive
+		std::string_view name;
 		int32_t crc = 0;
 		Flags flags = Flags::AllOS;
 		std::shared_ptr<std::vector<uint8_t>> data = nullptr;
 		uint64_t offset = 0;
 		uint64_t size = 0;
 		uint64_t sizeUncompressed = 0;
+		// XXH64 of the uncompressed data, 0 if unknown (e.g. files written prior to archive version 4)
+		uint64_t contentHash = 0;
+		// Solid files only: offset and size refer to the compressed block, which decompresses to blockSize bytes
+		// and contains the file data at blockOffset
+		uint64_t blockOffset = 0;
+		uint64_t blockSize = 0;
+		// Source file at the time it was published, all 0 if unknown (e.g. files written prior to archive version 7).
+		// A publish doesn't read files whose size, modification time and inode still match (see PublishOptions::skipUnchangedByStat).
+		FileStat sourceStat {};
 
 		bool IsDirectory() const;
 		bool IsFile() const;
 		bool IsCompressed() const;
+		bool IsSolid() const;
+		bool IsChunked() const;
+		Codec GetCodec() const;
+		void SetCodec(Codec codec);
 		bool operator==(P_OS os) const;
 		bool operator!=(P_OS os) const;
 	};
@@ -52,6 +73,10 @@ namespace pragma::uva {
 		std::string file;
 		P_OS os = P_OS::All;
 		std::string src;
+		// Overrides PublishOptions::codec for this file
+		std::optional<Codec> codec {};
+		// Set if the file was found by a directory walk
+		std::optional<FileStat> stat {};
 		std::string GetSourceName() const;
 	};
 };
@@ -19,20 +19,20 @@ int main(int argc, char *argv[])
 	for(auto &v : versions) {
 		std::cout << v.version.ToString() << std::endl;
 		for(auto idx : v.files) {
-			auto fi = f->GetByIndex(idx);
+			auto *fi = f->GetByIndex(idx);
 			std::cout << "\t" << idx << " (" << ((fi != nullptr) ? (fi->name) : "Invalid") << ")" << std::endl;
 			//std::cout<<"\t"<<idx<<" ("<<((fi != nullptr) ? (fi->GetFullPath() +fi->name) : "Invalid")<<")"<<std::endl;
 		}
 	}
 
 	std::cout << "\nHierarchy:" << std::endl;
-	auto &root = f->GetRoot();
-	std::function<void(uva::ArchiveFile::FileIndexInfo &, const std::string &)> fIterateHierarchy = nullptr;
-	fIterateHierarchy = [&f, &fIterateHierarchy](uva::ArchiveFile::FileIndexInfo &fii, const std::string &t) {
-		auto &fi = f->GetByIndex(fii.index);
+	auto root = f->GetRoot();
+	std::function<void(const uva::ArchiveFile::FileIndexInfo &, const std::string &)> fIterateHierarchy = nullptr;
+	fIterateHierarchy = [&f, &fIterateHierarchy](const uva::ArchiveFile::FileIndexInfo &fii, const std::string &t) {
+		auto *fi = f->GetByIndex(fii.index);
 		std::cout << t << fii.index << ": " << fi->name << " (" << fi->size << ") (" << fi->IsDirectory() << ")" << std::endl;
-		for(auto &child : fii.children)
-			fIterateHierarchy(*child, t + '\t');
+		for(auto child : fii.GetChildren())
+			fIterateHierarchy(child, t + '\t');
 	};
 	fIterateHierarchy(root, "\t");
 	/*auto &files = f->GetFiles();
@@ -65,9 +65,6 @@ int main(int argc, char *argv[])
 	//f->Extract("test_extract");
 	f->ExtractFile("models/props/metal_fence01.wmd");
 	std::cout << "All files have been extracted!" << std::endl;
-
-	for(;;)
-		;
 	return EXIT_SUCCESS;
 }
 #endif
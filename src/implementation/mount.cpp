@@ -0,0 +1,161 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+module pragma.uva;
+
+import :mount;
+
+static std::string normalize_mount_path(std::string_view path)
+{
+	std::string npath;
+	npath.reserve(path.size());
+	for(auto c : path) {
+		if(c == '\\')
+			c = '/';
+		if(c == '/' && (npath.empty() || npath.back() == '/'))
+			continue;
+		npath += static_cast<char>((c >= 'A' && c <= 'Z') ? (c - 'A' + 'a') : c);
+	}
+	if(npath.empty() == false && npath.back() == '/')
+		npath.pop_back();
+	return npath;
+}
+
+// Deleted files remain in the archive as empty entries without a payload (see ArchiveFile::Compact)
+static bool is_visible(const pragma::uva::FileInfo &fi) { return fi.IsDirectory() || fi.size > 0 || fi.data != nullptr; }
+
+void pragma::uva::Mount::AddArchive(const std::shared_ptr<const ArchiveFile> &archive, const std::string &mountPoint)
+{
+	if(archive == nullptr)
+		return;
+	std::unique_lock lock {m_mutex};
+	m_archives.push_back({archive, normalize_mount_path(mountPoint)});
+}
+
+bool pragma::uva::Mount::RemoveArchive(const ArchiveFile &archive)
+{
+	std::unique_lock lock {m_mutex};
+	auto it = std::find_if(m_archives.begin(), m_archives.end(), [&archive](const Entry &entry) { return entry.archive.get() == &archive; });
+	if(it == m_archives.end())
+		return false;
+	m_archives.erase(it);
+	return true;
+}
+
+void pragma::uva::Mount::Clear()
+{
+	std::unique_lock lock {m_mutex};
+	m_archives.clear();
+}
+
+std::optional<std::string> pragma::uva::Mount::GetArchivePath(const Entry &entry, const std::string &path)
+{
+	auto npath = normalize_mount_path(path);
+	auto &mountPoint = entry.mountPoint;
+	if(mountPoint.empty())
+		return npath;
+	if(npath.compare(0, mountPoint.size(), mountPoint) != 0)
+		return {};
+	if(npath.size() == mountPoint.size())
+		return std::string {};
+	if(npath.at(mountPoint.size()) != '/')
+		return {};
+	return npath.substr(mountPoint.size() + 1);
+}
+
+template<typename TFunc>
+void pragma::uva::Mount::ForEachArchive(const std::string &path, const TFunc &func) const
+{
+	for(auto it = m_archives.rbegin(); it != m_archives.rend(); ++it) {
+		auto archivePath = GetArchivePath(*it, path);
+		if(archivePath.has_value() && func(*it, *archivePath) == false)
+			break;
+	}
+}
+
+const pragma::uva::Mount::Entry *pragma::uva::Mount::FindEntry(const std::string &path, uint32_t &idx) const
+{
+	const Entry *result = nullptr;
+	ForEachArchive(path, [&result, &idx](const Entry &entry, const std::string &archivePath) {
+		// An empty path refers to the mount point itself, which is the root of the archive
+		if(archivePath.empty()) {
+			idx = 0;
+			result = &entry;
+			return false;
+		}
+		auto *fi = entry.archive->FindFile(archivePath, idx);
+		if(fi == nullptr || is_visible(*fi) == false)
+			return true;
+		result = &entry;
+		return false;
+	});
+	return result;
+}
+
+std::shared_ptr<pragma::uva::ArchiveFile::FileStream> pragma::uva::Mount::OpenFile(const std::string &path) const
+{
+	std::shared_lock lock {m_mutex};
+	uint32_t idx = 0;
+	auto *entry = FindEntry(path, idx);
+	if(entry == nullptr)
+		return nullptr;
+	auto stream = entry->archive->OpenFile(idx);
+	if(stream == nullptr)
+		return nullptr;
+	return std::shared_ptr<ArchiveFile::FileStream> {stream.release(), [archive = entry->archive](ArchiveFile::FileStream *stream) { delete stream; }};
+}
+
+bool pragma::uva::Mount::Exists(const std::string &path) const
+{
+	std::shared_lock lock {m_mutex};
+	uint32_t idx = 0;
+	return FindEntry(path, idx) != nullptr;
+}
+
+bool pragma::uva::Mount::IsDirectory(const std::string &path) const
+{
+	std::shared_lock lock {m_mutex};
+	uint32_t idx = 0;
+	auto *entry = FindEntry(path, idx);
+	return entry != nullptr && entry->archive->GetFiles().at(idx).IsDirectory();
+}
+
+uint64_t pragma::uva::Mount::GetFileSize(const std::string &path) const
+{
+	std::shared_lock lock {m_mutex};
+	uint32_t idx = 0;
+	auto *entry = FindEntry(path, idx);
+	if(entry == nullptr)
+		return 0;
+	auto &fi = entry->archive->GetFiles().at(idx);
+	return fi.IsFile() ? fi.sizeUncompressed : 0;
+}
+
+void pragma::uva::Mount::FindFiles(const std::string &path, std::vector<std::string> *files, std::vector<std::string> *dirs) const
+{
+	std::shared_lock lock {m_mutex};
+	// Names that have been seen already, an archive hides the entries of the same name in older archives
+	std::unordered_set<std::string> names;
+	ForEachArchive(path, [files, dirs, &names](const Entry &entry, const std::string &archivePath) {
+		auto &archive = *entry.archive;
+		uint32_t idx = 0;
+		if(archivePath.empty() == false) {
+			auto *fi = archive.FindFile(archivePath, idx);
+			if(fi == nullptr || fi->IsDirectory() == false)
+				return true;
+		}
+		auto &archiveFiles = archive.GetFiles();
+		auto fii = (idx == 0) ? archive.GetRoot() : *archive.FindFileIndexInfo(archiveFiles.at(idx));
+		for(auto child : fii.GetChildren()) {
+			auto &fi = archiveFiles.at(child.index);
+			if(is_visible(fi) == false || names.insert(normalize_mount_path(fi.name)).second == false)
+				continue;
+			auto *target = fi.IsDirectory() ? dirs : files;
+			if(target != nullptr)
+				target->push_back(std::string {fi.name});
+		}
+		return true;
+	});
+}
@@ -0,0 +1,50 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "definitions.hpp"
+
+export module pragma.uva:mount;
+
+import :archive_file;
+
+export namespace pragma::uva {
+	// Serves the files of one or more archives from a single virtual directory tree, so that assets can be loaded
+	// straight from the archives without extracting them first. Every archive is mounted at a path prefix; if several
+	// archives contain the same file, the one that was mounted last takes precedence. Lookups are case-insensitive and
+	// accept '/' as well as '\' as separator, like ArchiveFile::FindFile. Deleted files are treated as absent.
+	// All functions may be called concurrently.
+	// The mount is not registered with FileManager, FileManager::OpenFile doesn't see its files. A file system hook on
+	// the engine side can forward to OpenFile, Exists and FindFiles.
+	class DLLUVA Mount {
+	  public:
+		// The archive must not be modified while it is mounted
+		void AddArchive(const std::shared_ptr<const ArchiveFile> &archive, const std::string &mountPoint = "");
+		bool RemoveArchive(const ArchiveFile &archive);
+		void Clear();
+		// Returns nullptr if no mounted archive contains the file. The stream keeps the archive alive.
+		std::shared_ptr<ArchiveFile::FileStream> OpenFile(const std::string &path) const;
+		bool Exists(const std::string &path) const;
+		bool IsDirectory(const std::string &path) const;
+		// Uncompressed size, 0 if the file doesn't exist
+		uint64_t GetFileSize(const std::string &path) const;
+		// Names of the files and directories directly inside 'path', merged across all archives
+		void FindFiles(const std::string &path, std::vector<std::string> *files, std::vector<std::string> *dirs) const;
+	  private:
+		struct Entry {
+			std::shared_ptr<const ArchiveFile> archive;
+			// Lower-case, '/' as separator, no leading or trailing separators
+			std::string mountPoint;
+		};
+		// Path relative to the root of the archive, nullopt if 'path' is outside of the mount point
+		static std::optional<std::string> GetArchivePath(const Entry &entry, const std::string &path);
+		// Newest archive first
+		template<typename TFunc>
+		void ForEachArchive(const std::string &path, const TFunc &func) const;
+		// Archive that provides the file or directory, nullptr if there is none
+		const Entry *FindEntry(const std::string &path, uint32_t &idx) const;
+		std::vector<Entry> m_archives;
+		mutable std::shared_mutex m_mutex;
+	};
+};
@@ -0,0 +1,203 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+module pragma.uva;
+
+import :native_file;
+
+// Chunk size for copies that have to go through user space
+static constexpr uint64_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+std::unique_ptr<pragma::uva::NativeFile> pragma::uva::NativeFile::Open(const std::string &path, Mode mode)
+{
+	std::unique_ptr<NativeFile> f {new NativeFile {}};
+#ifdef _WIN32
+	DWORD access = (mode == Mode::ReadWrite) ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ;
+	auto h = CreateFileA(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(h == INVALID_HANDLE_VALUE)
+		return nullptr;
+	f->m_fileHandle = h;
+	LARGE_INTEGER size;
+	if(GetFileSizeEx(h, &size) == FALSE)
+		return nullptr;
+	f->m_size = static_cast<uint64_t>(size.QuadPart);
+#else
+	auto fd = ::open(path.c_str(), ((mode == Mode::ReadWrite) ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+	if(fd == -1)
+		return nullptr;
+	f->m_fd = fd;
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+		return nullptr;
+	f->m_size = static_cast<uint64_t>(st.st_size);
+#endif
+	return f;
+}
+
+pragma::uva::NativeFile::~NativeFile()
+{
+#ifdef _WIN32
+	if(m_mappedData != nullptr)
+		UnmapViewOfFile(m_mappedData);
+	if(m_mappingHandle != nullptr)
+		CloseHandle(m_mappingHandle);
+	if(m_fileHandle != nullptr)
+		CloseHandle(m_fileHandle);
+#else
+	if(m_mappedData != nullptr)
+		munmap(const_cast<uint8_t *>(m_mappedData), m_size);
+	if(m_fd != -1)
+		::close(m_fd);
+#endif
+}
+
+uint64_t pragma::uva::NativeFile::GetSize() const { return m_size; }
+
+bool pragma::uva::NativeFile::ReadAt(uint64_t offset, void *data, uint64_t size) const
+{
+	auto *dst = static_cast<uint8_t *>(data);
+	if(m_mappedData != nullptr) {
+		auto range = GetMappedRange(offset, size);
+		if(range.size() != size)
+			return false;
+		std::memcpy(dst, range.data(), range.size());
+		return true;
+	}
+	while(size > 0) {
+#ifdef _WIN32
+		// Overlapped reads on a synchronous handle are positional, they don't rely on the current file pointer
+		OVERLAPPED ov {};
+		ov.Offset = static_cast<DWORD>(offset);
+		ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+		DWORD numRead = 0;
+		auto szChunk = static_cast<DWORD>(std::min<uint64_t>(size, std::numeric_limits<DWORD>::max()));
+		if(ReadFile(m_fileHandle, dst, szChunk, &numRead, &ov) == FALSE || numRead == 0)
+			return false;
+#else
+		auto szChunk = static_cast<size_t>(std::min<uint64_t>(size, std::numeric_limits<ssize_t>::max()));
+		auto numRead = pread(m_fd, dst, szChunk, static_cast<off_t>(offset));
+		if(numRead == -1 && errno == EINTR)
+			continue;
+		if(numRead <= 0)
+			return false;
+#endif
+		dst += numRead;
+		offset += numRead;
+		size -= numRead;
+	}
+	return true;
+}
+
+bool pragma::uva::NativeFile::WriteAt(uint64_t offset, const void *data, uint64_t size)
+{
+	auto *src = static_cast<const uint8_t *>(data);
+	while(size > 0) {
+#ifdef _WIN32
+		OVERLAPPED ov {};
+		ov.Offset = static_cast<DWORD>(offset);
+		ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+		DWORD numWritten = 0;
+		auto szChunk = static_cast<DWORD>(std::min<uint64_t>(size, std::numeric_limits<DWORD>::max()));
+		if(WriteFile(m_fileHandle, src, szChunk, &numWritten, &ov) == FALSE || numWritten == 0)
+			return false;
+#else
+		auto szChunk = static_cast<size_t>(std::min<uint64_t>(size, std::numeric_limits<ssize_t>::max()));
+		auto numWritten = pwrite(m_fd, src, szChunk, static_cast<off_t>(offset));
+		if(numWritten == -1 && errno == EINTR)
+			continue;
+		if(numWritten <= 0)
+			return false;
+#endif
+		src += numWritten;
+		offset += numWritten;
+		size -= numWritten;
+		m_size = std::max(m_size, offset);
+	}
+	return true;
+}
+
+bool pragma::uva::NativeFile::CopyFrom(const NativeFile &src, uint64_t srcOffset, uint64_t dstOffset, uint64_t size, std::vector<uint8_t> &buffer)
+{
+#ifdef __linux__
+	while(size > 0) {
+		auto offIn = static_cast<loff_t>(srcOffset);
+		auto offOut = static_cast<loff_t>(dstOffset);
+		auto szChunk = static_cast<size_t>(std::min<uint64_t>(size, std::numeric_limits<ssize_t>::max()));
+		auto numCopied = copy_file_range(src.m_fd, &offIn, m_fd, &offOut, szChunk, 0);
+		if(numCopied == -1 && errno == EINTR)
+			continue;
+		if(numCopied <= 0)
+			break; // Not supported for these files (e.g. older kernels or across file systems), copy the rest manually
+		srcOffset += numCopied;
+		dstOffset += numCopied;
+		size -= numCopied;
+		m_size = std::max(m_size, dstOffset);
+	}
+#endif
+	if(size > 0 && buffer.size() < std::min(size, COPY_BUFFER_SIZE))
+		buffer.resize(std::min(size, COPY_BUFFER_SIZE));
+	while(size > 0) {
+		auto n = std::min<uint64_t>(size, buffer.size());
+		if(src.ReadAt(srcOffset, buffer.data(), n) == false || WriteAt(dstOffset, buffer.data(), n) == false)
+			return false;
+		srcOffset += n;
+		dstOffset += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool pragma::uva::NativeFile::Sync()
+{
+#ifdef _WIN32
+	return FlushFileBuffers(m_fileHandle) != FALSE;
+#else
+	return fsync(m_fd) == 0;
+#endif
+}
+
+bool pragma::uva::NativeFile::Map()
+{
+	if(m_mappedData != nullptr)
+		return true;
+	if(m_size == 0 || m_size > std::numeric_limits<size_t>::max())
+		return false;
+#ifdef _WIN32
+	m_mappingHandle = CreateFileMappingA(m_fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(m_mappingHandle == nullptr)
+		return false;
+	auto *data = MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if(data == nullptr) {
+		CloseHandle(m_mappingHandle);
+		m_mappingHandle = nullptr;
+		return false;
+	}
+#else
+	auto *data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+	if(data == MAP_FAILED)
+		return false;
+#endif
+	m_mappedData = static_cast<const uint8_t *>(data);
+	return true;
+}
+
+bool pragma::uva::NativeFile::IsMapped() const { return m_mappedData != nullptr; }
+
+std::span<const uint8_t> pragma::uva::NativeFile::GetMappedRange(uint64_t offset, uint64_t size) const
+{
+	if(m_mappedData == nullptr || offset > m_size || size > m_size - offset)
+		return {};
+	return std::span<const uint8_t> {m_mappedData + offset, static_cast<size_t>(size)};
+}
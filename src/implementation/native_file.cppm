@@ -0,0 +1,49 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+export module pragma.uva:native_file;
+
+export import std.compat;
+
+export namespace pragma::uva {
+	// Handle to a file on disk that bypasses the virtual file system, so that the archive contents
+	// can be mapped into memory, read from several threads at once or copied without a user space buffer.
+	class NativeFile {
+	  public:
+		enum class Mode : uint8_t { Read = 0, ReadWrite };
+		// The file has to exist
+		static std::unique_ptr<NativeFile> Open(const std::string &path, Mode mode = Mode::Read);
+		NativeFile(const NativeFile &) = delete;
+		NativeFile &operator=(const NativeFile &) = delete;
+		~NativeFile();
+
+		uint64_t GetSize() const;
+		// Positional read that does not touch a shared file pointer, so it is safe to call concurrently.
+		// Returns false if fewer than 'size' bytes could be read.
+		bool ReadAt(uint64_t offset, void *data, uint64_t size) const;
+		// Positional write, requires Mode::ReadWrite
+		bool WriteAt(uint64_t offset, const void *data, uint64_t size);
+		// Copies a range of 'src' into this file. Uses copy_file_range where available, so the data stays in the
+		// kernel, and falls back to copying through 'buffer' otherwise.
+		bool CopyFrom(const NativeFile &src, uint64_t srcOffset, uint64_t dstOffset, uint64_t size, std::vector<uint8_t> &buffer);
+		// Blocks until everything written to the file so far has reached the storage device
+		bool Sync();
+		// Maps the entire file into memory. Returns false if the file could not be mapped (e.g. if it is empty).
+		bool Map();
+		bool IsMapped() const;
+		// Returns an empty span if the file is not mapped or the range is out of bounds
+		std::span<const uint8_t> GetMappedRange(uint64_t offset, uint64_t size) const;
+	  private:
+		NativeFile() = default;
+		uint64_t m_size = 0;
+		const uint8_t *m_mappedData = nullptr;
+#ifdef _WIN32
+		void *m_fileHandle = nullptr;
+		void *m_mappingHandle = nullptr;
+#else
+		int m_fd = -1;
+#endif
+	};
+};
@@ -0,0 +1,109 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+module pragma.uva;
+
+import :thread_pool;
+
+uint32_t pragma::uva::ThreadPool::get_thread_count(uint32_t numThreads)
+{
+	if(numThreads == 0)
+		numThreads = std::thread::hardware_concurrency();
+	return std::max<uint32_t>(numThreads, 1);
+}
+
+pragma::uva::ThreadPool::ThreadPool(uint32_t numThreads)
+{
+	numThreads = get_thread_count(numThreads);
+	m_workers.reserve(numThreads);
+	for(auto i = decltype(numThreads) {0}; i < numThreads; ++i)
+		m_workers.push_back(std::make_unique<Worker>());
+	m_threads.reserve(numThreads);
+	for(auto i = decltype(numThreads) {0}; i < numThreads; ++i)
+		m_threads.emplace_back([this, i]() { Run(i); });
+}
+
+pragma::uva::ThreadPool::~ThreadPool()
+{
+	{
+		std::scoped_lock lock {m_stateMutex};
+		m_stop = true;
+	}
+	m_taskAvailable.notify_all();
+	for(auto &t : m_threads)
+		t.join();
+}
+
+uint32_t pragma::uva::ThreadPool::GetThreadCount() const { return static_cast<uint32_t>(m_threads.size()); }
+
+void pragma::uva::ThreadPool::Submit(Task task)
+{
+	{
+		// Count the task before it becomes visible, so the counters can never underflow
+		std::scoped_lock lock {m_stateMutex};
+		++m_numQueued;
+		++m_numPending;
+	}
+	auto &worker = *m_workers.at(m_nextWorker++ % m_workers.size());
+	{
+		std::scoped_lock lock {worker.mutex};
+		worker.tasks.push_back(std::move(task));
+	}
+	m_taskAvailable.notify_one();
+}
+
+void pragma::uva::ThreadPool::Wait()
+{
+	std::unique_lock lock {m_stateMutex};
+	m_tasksCompleted.wait(lock, [this]() { return m_numPending == 0; });
+}
+
+bool pragma::uva::ThreadPool::PopTask(uint32_t workerIdx, Task &outTask)
+{
+	auto found = false;
+	{
+		// Own queue is processed FIFO, callers rely on tasks being started in submission order (e.g. reads sorted by offset)
+		auto &worker = *m_workers.at(workerIdx);
+		std::scoped_lock lock {worker.mutex};
+		if(worker.tasks.empty() == false) {
+			outTask = std::move(worker.tasks.front());
+			worker.tasks.pop_front();
+			found = true;
+		}
+	}
+	// Steal the newest task from one of the other workers, so the victim continues with its queue in order
+	for(auto i = decltype(m_workers.size()) {1}; found == false && i < m_workers.size(); ++i) {
+		auto &victim = *m_workers.at((workerIdx + i) % m_workers.size());
+		std::scoped_lock lock {victim.mutex};
+		if(victim.tasks.empty())
+			continue;
+		outTask = std::move(victim.tasks.back());
+		victim.tasks.pop_back();
+		found = true;
+	}
+	if(found) {
+		std::scoped_lock lock {m_stateMutex};
+		--m_numQueued;
+	}
+	return found;
+}
+
+void pragma::uva::ThreadPool::Run(uint32_t workerIdx)
+{
+	for(;;) {
+		Task task;
+		if(PopTask(workerIdx, task)) {
+			task();
+			std::scoped_lock lock {m_stateMutex};
+			if(--m_numPending == 0)
+				m_tasksCompleted.notify_all();
+			continue;
+		}
+		std::unique_lock lock {m_stateMutex};
+		m_taskAvailable.wait(lock, [this]() { return m_stop || m_numQueued > 0; });
+		if(m_stop && m_numQueued == 0)
+			return;
+	}
+}
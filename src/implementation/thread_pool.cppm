@@ -0,0 +1,47 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+export module pragma.uva:thread_pool;
+
+export import std.compat;
+
+export namespace pragma::uva {
+	// Fixed-size worker pool. Each worker owns a task queue and steals from the queues of
+	// the other workers once its own queue runs dry. A worker starts its own tasks in the
+	// order they were submitted.
+	class ThreadPool {
+	  public:
+		using Task = std::function<void()>;
+		// Resolves a requested thread count, 0 meaning one thread per hardware thread
+		static uint32_t get_thread_count(uint32_t numThreads);
+
+		ThreadPool(uint32_t numThreads = 0);
+		ThreadPool(const ThreadPool &) = delete;
+		ThreadPool &operator=(const ThreadPool &) = delete;
+		~ThreadPool();
+		uint32_t GetThreadCount() const;
+		// May also be called from within a task
+		void Submit(Task task);
+		// Blocks until all submitted tasks have been completed
+		void Wait();
+	  private:
+		struct Worker {
+			std::mutex mutex;
+			std::deque<Task> tasks;
+		};
+		bool PopTask(uint32_t workerIdx, Task &outTask);
+		void Run(uint32_t workerIdx);
+		std::vector<std::unique_ptr<Worker>> m_workers;
+		std::vector<std::thread> m_threads;
+		std::atomic<uint32_t> m_nextWorker = 0;
+
+		std::mutex m_stateMutex;
+		std::condition_variable m_taskAvailable;
+		std::condition_variable m_tasksCompleted;
+		uint64_t m_numQueued = 0;
+		uint64_t m_numPending = 0;
+		bool m_stop = false;
+	};
+};
@@ -3,5 +3,8 @@
 
 export module pragma.uva;
 export import :archive_file;
+export import :codec;
+export import :directory_walker;
 export import :fileinfo;
+export import :mount;
 export import :version_info;
@@ -0,0 +1,146 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+// Reads one archive from many threads at once, starting right after it has been opened so that the lazily loaded
+// metadata is raced as well, and verifies every result against the CRC in the archive and the source data.
+
+import pragma.uva;
+
+namespace {
+	constexpr uint32_t NUM_FILES = 400;
+	constexpr uint32_t NUM_OPERATIONS = 500;
+	constexpr uint32_t MIN_THREADS = 8;
+
+	// The library reports its progress through std::cout
+	class ScopedSilence {
+	  public:
+		ScopedSilence() : m_buf {std::cout.rdbuf(m_null.rdbuf())} {}
+		~ScopedSilence() { std::cout.rdbuf(m_buf); }
+	  private:
+		std::ostringstream m_null;
+		std::streambuf *m_buf = nullptr;
+	};
+
+	uint32_t calc_crc32(std::span<const uint8_t> data)
+	{
+		static const auto table = []() {
+			std::array<uint32_t, 256> table {};
+			for(uint32_t i = 0; i < table.size(); ++i) {
+				auto c = i;
+				for(auto j = 0; j < 8; ++j)
+					c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+				table[i] = c;
+			}
+			return table;
+		}();
+		auto crc = 0xFFFFFFFFu;
+		for(auto b : data)
+			crc = table[(crc ^ b) & 0xFF] ^ (crc >> 8);
+		return crc ^ 0xFFFFFFFFu;
+	}
+};
+
+// Sizes cover solid (up to 4 KiB), regular and chunked (above 64 KiB) files
+static std::map<std::string, std::vector<uint8_t>> generate_source_tree(const std::filesystem::path &srcDir)
+{
+	std::mt19937_64 rng {1};
+	std::map<std::string, std::vector<uint8_t>> files;
+	for(uint32_t i = 0; i < NUM_FILES; ++i) {
+		auto name = "d" + std::to_string(i % 16) + "/f" + std::to_string(i) + ".bin";
+		auto size = std::array<uint64_t, 3> {1'024, 32 * 1'024, 160 * 1'024}.at(i % 3) + rng() % 1'024;
+		std::vector<uint8_t> data(size);
+		for(auto &b : data)
+			b = static_cast<uint8_t>((rng() % 4 == 0) ? rng() : 'a' + (i % 26));
+		auto path = srcDir / name;
+		std::filesystem::create_directories(path.parent_path());
+		std::ofstream {path, std::ios::binary}.write(reinterpret_cast<const char *>(data.data()), data.size());
+		files[name] = std::move(data);
+	}
+	return files;
+}
+
+static uint32_t run_readers(const std::string &archivePath, pragma::uva::ArchiveFile::OpenFlags flags, uint64_t dataCacheSize, const std::map<std::string, std::vector<uint8_t>> &files)
+{
+	auto archive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(archivePath, nullptr, nullptr, flags));
+	if(archive == nullptr)
+		return 1;
+	archive->SetDataCacheSize(dataCacheSize);
+	std::vector<const std::pair<const std::string, std::vector<uint8_t>> *> entries;
+	for(auto &pair : files)
+		entries.push_back(&pair);
+
+	auto numThreads = std::max(std::thread::hardware_concurrency(), MIN_THREADS);
+	std::atomic<uint32_t> numFailed = 0;
+	std::latch start {static_cast<std::ptrdiff_t>(numThreads)};
+	std::vector<std::thread> threads;
+	for(auto t = decltype(numThreads) {0}; t < numThreads; ++t) {
+		threads.emplace_back([&, t]() {
+			std::mt19937_64 rng {t + 1};
+			std::vector<uint8_t> data;
+			start.arrive_and_wait();
+			for(uint32_t i = 0; i < NUM_OPERATIONS; ++i) {
+				auto &[name, expected] = *entries.at(rng() % entries.size());
+				if(rng() % 2 == 0) {
+					uint32_t idx;
+					auto *fi = archive->FindFile(name, idx);
+					if(fi == nullptr || archive->ExtractData(name, data) == false || calc_crc32(data) != static_cast<uint32_t>(fi->crc) || data != expected) {
+						std::cerr << "ExtractData of '" << name << "' failed!" << std::endl;
+						++numFailed;
+					}
+					continue;
+				}
+				auto offset = rng() % expected.size();
+				auto size = std::min<uint64_t>(rng() % (64 * 1'024) + 1, expected.size() - offset);
+				data.resize(size);
+				if(archive->ReadRange(name, offset, data) == false || std::equal(data.begin(), data.end(), expected.begin() + offset) == false) {
+					std::cerr << "ReadRange of '" << name << "' (" << offset << ", " << size << ") failed!" << std::endl;
+					++numFailed;
+				}
+			}
+		});
+	}
+	for(auto &thread : threads)
+		thread.join();
+	return numFailed;
+}
+
+int main()
+{
+	auto workDir = std::filesystem::absolute("uva_concurrency_test");
+	auto srcDir = workDir / "src";
+	std::filesystem::remove_all(workDir);
+	std::filesystem::create_directories(srcDir);
+	auto files = generate_source_tree(srcDir);
+	auto listFile = (workDir / "list.txt").string();
+	std::ofstream {listFile} << "src/**\n";
+	auto archivePath = (workDir / "test.dat").string();
+
+	pragma::uva::PublishOptions options {};
+	options.codec = pragma::uva::Codec::Bzip2;
+	options.solidBlockSize = 64 * 1'024;
+	options.solidFileSizeLimit = 4 * 1'024;
+	options.chunkSize = 64 * 1'024;
+	util::Version version {0, 0, 1};
+	pragma::uva::ArchiveFile::UpdateResult result;
+	{
+		ScopedSilence silence {};
+		result = pragma::uva::ArchiveFile::PublishUpdate(version, listFile, archivePath, nullptr, nullptr, nullptr, options);
+	}
+	if(result != pragma::uva::ArchiveFile::UpdateResult::Success) {
+		std::cerr << "Unable to publish test archive: " << pragma::uva::ArchiveFile::result_code_to_string(result) << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	uint32_t numFailed = 0;
+	for(auto flags : {pragma::uva::ArchiveFile::OpenFlags::None, pragma::uva::ArchiveFile::OpenFlags::MemoryMapped}) {
+		for(auto dataCacheSize : {uint64_t {0}, uint64_t {4 * 1'024 * 1'024}})
+			numFailed += run_readers(archivePath, flags, dataCacheSize, files);
+	}
+	std::filesystem::remove_all(workDir);
+	if(numFailed > 0) {
+		std::cerr << numFailed << " reads failed!" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "All reads succeeded." << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+// Sets a present-day modification time on source files and verifies that it arrives unchanged in get_file_stat,
+// walk_directory and, after a publish, in the source stat stored in the archive.
+
+import pragma.uva;
+
+namespace {
+	// 2024-06-01 12:00:00 UTC plus a fraction that NTFS (100 ns resolution) can represent as well
+	constexpr int64_t MTIME = 1'717'243'200'123'456'700;
+
+	class ScopedSilence {
+	  public:
+		ScopedSilence() : m_buf {std::cout.rdbuf(m_null.rdbuf())} {}
+		~ScopedSilence() { std::cout.rdbuf(m_buf); }
+	  private:
+		std::ostringstream m_null;
+		std::streambuf *m_buf = nullptr;
+	};
+};
+
+static bool check_stat(const std::string &what, const pragma::uva::FileStat &stat, uint64_t size)
+{
+	if(stat.size == size && stat.mtime == MTIME)
+		return true;
+	std::cerr << what << ": Expected size " << size << " and mtime " << MTIME << ", got " << stat.size << " and " << stat.mtime << "!" << std::endl;
+	return false;
+}
+
+int main()
+{
+	auto workDir = std::filesystem::absolute("uva_file_stat_test");
+	std::filesystem::remove_all(workDir);
+	std::filesystem::create_directories(workDir / "src" / "walked");
+	std::filesystem::create_directories(workDir / "src" / "listed");
+	auto mtime = std::filesystem::file_time_type::clock::from_sys(std::chrono::sys_time<std::chrono::nanoseconds> {std::chrono::nanoseconds {MTIME}});
+	const std::string content = "The quick brown fox jumps over the lazy dog.";
+	for(auto *name : {"walked/a.txt", "listed/b.txt"}) {
+		auto path = workDir / "src" / name;
+		std::ofstream {path, std::ios::binary} << content;
+		std::filesystem::last_write_time(path, std::chrono::time_point_cast<std::filesystem::file_time_type::duration>(mtime));
+	}
+
+	auto success = true;
+	pragma::uva::FileStat stat;
+	success = pragma::uva::get_file_stat((workDir / "src" / "listed" / "b.txt").string(), stat) && check_stat("get_file_stat", stat, content.size()) && success;
+	auto entries = pragma::uva::walk_directory((workDir / "src" / "walked").string(), 1);
+	success = entries.size() == 1 && check_stat("walk_directory", entries.front().stat, content.size()) && success;
+
+	// Directories are walked, explicitly listed files are queried with get_file_stat
+	auto listFile = (workDir / "src" / "list.txt").string();
+	std::ofstream {listFile} << "walked/**\nlisted/b.txt\n";
+	auto archivePath = (workDir / "test.dat").string();
+	util::Version version {0, 0, 1};
+	pragma::uva::ArchiveFile::UpdateResult result;
+	{
+		ScopedSilence silence {};
+		result = pragma::uva::ArchiveFile::PublishUpdate(version, listFile, archivePath);
+	}
+	if(result == pragma::uva::ArchiveFile::UpdateResult::Success) {
+		auto archive = std::unique_ptr<pragma::uva::ArchiveFile>(pragma::uva::ArchiveFile::Open(archivePath));
+		for(auto *name : {"a.txt", "b.txt"}) {
+			auto *fi = (archive != nullptr) ? archive->FindFile(name) : nullptr;
+			if(fi == nullptr) {
+				std::cerr << "File '" << name << "' is missing from the archive!" << std::endl;
+				success = false;
+				continue;
+			}
+			success = check_stat(std::string {"Archived source stat of '"} + name + "'", fi->sourceStat, content.size()) && success;
+		}
+	}
+	else {
+		std::cerr << "Unable to publish test archive: " << pragma::uva::ArchiveFile::result_code_to_string(result) << std::endl;
+		success = false;
+	}
+	std::filesystem::remove_all(workDir);
+	if(success == false)
+		return EXIT_FAILURE;
+	std::cout << "All file stats match." << std::endl;
+	return EXIT_SUCCESS;
+}